@@ -18,6 +18,7 @@
 #   include <codecvt>
 #else
 #   include <unistd.h>
+#   include <fcntl.h>
 #   include <sys/types.h>
 #   include <pwd.h>
 #   include <boost/process.hpp>
@@ -231,5 +232,35 @@ std::string getDefaultPeersFile()
         utils::getDefaultDatabaseFolder(), PATH_SEPERATOR, "peers.txt");
 }
 
+void syncFile(const std::string& filename)
+{
+#ifdef _WINDOWS
+    const auto handle = ::CreateFileA(filename.c_str(), GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, 
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error(fmt::format("could not open '{}' to sync it", filename));
+    }
+
+    const bool synced = ::FlushFileBuffers(handle);
+    ::CloseHandle(handle);
+#else
+    const auto fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error(fmt::format("could not open '{}' to sync it", filename));
+    }
+
+    const bool synced = (::fsync(fd) == 0);
+    ::close(fd);
+#endif
+
+    if (!synced)
+    {
+        throw std::runtime_error(fmt::format("could not sync '{}'", filename));
+    }
+}
+
 
 } // namespace
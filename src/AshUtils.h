@@ -3,9 +3,16 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include <map>
+#include <stdexcept>
 
 namespace utils
 {
@@ -34,4 +41,91 @@ std::string getDefaultConfigFile();
 std::string getDefaultDatabaseFolder();
 std::string getDefaultPeersFile();
 
+// makes sure the written contents of the file are on disk
+void syncFile(const std::string& filename);
+
+// true when `ptr` is the only owner of its object, so the caller may
+// change it. The count is read relaxed, the fence orders the changes 
+// after the reads of the owners that released the object on other threads.
+template<typename T>
+bool IsSoleOwner(const std::shared_ptr<T>& ptr)
+{
+    if (ptr.use_count() != 1)
+    {
+        return false;
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+// calls `func(begin, end)` over [0, count), splitting the range across
+// up to std::thread::hardware_concurrency() threads so that each thread
+// gets at least `grain` items. The threads are always joined, and the
+// first exception `func` throws on any of them is rethrown after that.
+template<typename Func>
+void ParallelFor(std::size_t count, std::size_t grain, Func func)
+{
+    const std::size_t hwthreads = std::max(1u, std::thread::hardware_concurrency());
+    const auto workers = std::min(hwthreads, count / std::max<std::size_t>(grain, 1u));
+    if (workers <= 1)
+    {
+        func(std::size_t{0}, count);
+        return;
+    }
+
+    const auto chunk = (count + workers - 1) / workers;
+
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto run = 
+        [func, &error, &errorMutex](std::size_t begin, std::size_t end) mutable
+        {
+            try
+            {
+                func(begin, end);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock{errorMutex};
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+            }
+        };
+
+    // joins the threads that were started even when starting one throws
+    struct Joiner
+    {
+        std::vector<std::thread> threads;
+
+        ~Joiner()
+        {
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+        }
+    };
+
+    {
+        Joiner joiner;
+        joiner.threads.reserve(workers - 1);
+        for (std::size_t worker = 1; worker < workers; worker++)
+        {
+            const auto begin = std::min(count, worker * chunk);
+            const auto end = std::min(count, begin + chunk);
+            joiner.threads.emplace_back(run, begin, end);
+        }
+
+        run(std::size_t{0}, chunk);
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
 } // namespace
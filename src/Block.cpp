@@ -1,9 +1,14 @@
 #include <sstream>
 #include <ostream>
 #include <ctime>
+#include <charconv>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
 
 #include "CryptoUtils.h"
 #include "Block.h"
+#include "MerkleTree.h"
 
 namespace nl = nlohmann;
 
@@ -20,6 +25,16 @@ void to_json(nl::json& j, const Block& b)
     j["miner"] = b.miner();
     j["data"] = b.data();
     j["transactions"] = b.transactions();
+    j["version"] = static_cast<std::uint32_t>(b.version());
+    j["merkleroot"] = b.merkleRoot();
+
+    // a pruned block only has its header, the digest of the transactions
+    // it no longer has is sent so its hash can still be checked
+    if (!b.hasTransactions())
+    {
+        j["pruned"] = true;
+        j["txdigest"] = b.txDigest();
+    }
 
     j["time"] = 
         static_cast<std::uint64_t>(b.time().time_since_epoch().count());
@@ -35,6 +50,32 @@ void from_json(const nl::json& j, Block& b)
     j["hash"].get_to(b._hash);
     j["miner"].get_to(b._miner);
     j["transactions"].get_to(b._hashed._txs);
+    b._hasTransactions = true;
+    b._txDigest.clear();
+    b._merkleRoot.clear();
+
+    if (j.value("pruned", false))
+    {
+        if (!j.contains("txdigest") || !b._hashed._txs.empty())
+        {
+            throw std::logic_error(fmt::format("pruned block #{} is malformed", b._hashed._index));
+        }
+
+        b._hasTransactions = false;
+        j["txdigest"].get_to(b._txDigest);
+        j.at("merkleroot").get_to(b._merkleRoot);
+    }
+
+    // blocks from before the version was recorded use the TEXT rules
+    const auto version = j.value("version", 
+        static_cast<std::uint32_t>(HashVersion::TEXT));
+    if (version < static_cast<std::uint32_t>(HashVersion::TEXT)
+        || version > static_cast<std::uint32_t>(CURRENT_HASH_VERSION))
+    {
+        throw std::logic_error(fmt::format("unsupported block version {}", version));
+    }
+
+    b._version = static_cast<HashVersion>(version);
 
     b._hashed._time = 
         BlockTime{std::chrono::milliseconds{j["time"].get<std::uint64_t>()}};
@@ -92,9 +133,6 @@ std::string CalculateBlockHash(
 
 std::string CalculateBlockHash(const Block& block)
 {
-    const auto extra = 
-        ash::crypto::SHA256(nl::json(block.transactions()).dump());
-
     return CalculateBlockHash(
         block.index(),
         block.nonce(),
@@ -102,7 +140,162 @@ std::string CalculateBlockHash(const Block& block)
         block.time(),
         block.data(),
         block.previousHash(),
-        extra );
+        block.txDigest() );
+}
+
+namespace
+{
+
+// writes the decimal text of `value` exactly as `std::ostream` does
+// in the classic locale and returns the number of characters written
+template<typename T>
+std::size_t WriteDecimal(char* buffer, std::size_t size, T value)
+{
+    auto [end, ec] = std::to_chars(buffer, buffer + size, value);
+    assert(ec == std::errc{});
+    return static_cast<std::size_t>(end - buffer);
+}
+
+template<typename T>
+void AppendDecimal(std::string& out, T value)
+{
+    char buffer[24];
+    out.append(buffer, WriteDecimal(buffer, sizeof(buffer), value));
+}
+
+} // namespace
+
+BlockHasher::BlockHasher(std::uint64_t index,
+    std::uint64_t difficulty,
+    const std::string& data,
+    const std::string& previous,
+    const std::string& extra,
+    const crypto::SHA256Kernel& kernel)
+    : _kernel{ kernel }
+{
+    AppendDecimal(_prefix, index);
+
+    AppendDecimal(_tailHead, difficulty);
+    _tailHead.append(data);
+
+    _tailEnd.reserve(previous.size() + extra.size());
+    _tailEnd.append(previous);
+    _tailEnd.append(extra);
+}
+
+void BlockHasher::setTime(BlockTime time)
+{
+    _tail.clear();
+    _tail.reserve(_tailHead.size() + 24 + _tailEnd.size());
+    _tail.append(_tailHead);
+    AppendDecimal(_tail, time.time_since_epoch().count());
+    _tail.append(_tailEnd);
+
+    // make room for the longest nonce now so hashing never allocates
+    constexpr auto maxDigits = std::numeric_limits<std::uint64_t>::digits10 + 1;
+    const auto maxSize = _prefix.size() + maxDigits + _tail.size() + 1 + 8;
+    _messages.reserve(crypto::SHA256MaxLanes 
+        * (((maxSize + crypto::SHA256BlockSize - 1) / crypto::SHA256BlockSize) * crypto::SHA256BlockSize));
+
+    _digits = 0;
+}
+
+void BlockHasher::prepareMessages(std::size_t digits)
+{
+    const auto length = _prefix.size() + digits + _tail.size();
+    const auto bitLength = static_cast<std::uint64_t>(length) * 8;
+
+    // room for the 0x80 terminator and the 64-bit length
+    _messageSize = ((length + 1 + 8 + crypto::SHA256BlockSize - 1) 
+        / crypto::SHA256BlockSize) * crypto::SHA256BlockSize;
+
+    _messages.assign(crypto::SHA256MaxLanes * _messageSize, 0);
+
+    for (auto lane = 0u; lane < crypto::SHA256MaxLanes; lane++)
+    {
+        auto message = _messages.data() + (lane * _messageSize);
+        std::copy(_prefix.begin(), _prefix.end(), message);
+        std::copy(_tail.begin(), _tail.end(), message + _prefix.size() + digits);
+        message[length] = 0x80;
+
+        for (auto idx = 0u; idx < 8; idx++)
+        {
+            message[_messageSize - 1 - idx] = static_cast<std::uint8_t>(bitLength >> (idx * 8));
+        }
+    }
+
+    _digits = digits;
+}
+
+void BlockHasher::hash(std::uint64_t nonce, HashDigest& digest)
+{
+    hash(nonce, 0, 1, &digest);
+}
+
+std::string BlockHasher::hash(std::uint64_t nonce)
+{
+    HashDigest digest;
+    hash(nonce, digest);
+    return ToHexString(digest);
+}
+
+void BlockHasher::hash(std::uint64_t first, std::uint64_t stride, std::size_t count, HashDigest* digests)
+{
+    assert(count > 0 && count <= crypto::SHA256MaxLanes);
+
+    char buffer[24];
+    const auto digits = WriteDecimal(buffer, sizeof(buffer), first);
+    const auto last = first + (stride * (count - 1));
+
+    // the messages of a batch have to be the same length to be hashed
+    // together, so a batch that crosses a power of ten is split up
+    if (last < first || WriteDecimal(buffer, sizeof(buffer), last) != digits)
+    {
+        for (std::size_t idx = 0; idx < count; idx++)
+        {
+            hash(first + (stride * idx), 0, 1, digests + idx);
+        }
+
+        return;
+    }
+
+    if (digits != _digits)
+    {
+        prepareMessages(digits);
+    }
+
+    crypto::SHA256State states[crypto::SHA256MaxLanes];
+    const std::uint8_t* messages[crypto::SHA256MaxLanes];
+
+    for (std::size_t idx = 0; idx < count; idx++)
+    {
+        auto message = _messages.data() + (idx * _messageSize);
+        WriteDecimal(reinterpret_cast<char*>(message) + _prefix.size(), digits, first + (stride * idx));
+
+        states[idx] = crypto::SHA256InitialState;
+        messages[idx] = message;
+    }
+
+    _kernel.transformLanes(states, messages, _messageSize / crypto::SHA256BlockSize, count);
+
+    for (std::size_t idx = 0; idx < count; idx++)
+    {
+        crypto::SHA256StateToDigest(states[idx], digests[idx].data());
+    }
+}
+
+std::string ToHexString(const HashDigest& digest)
+{
+    constexpr std::string_view hexchars = "0123456789abcdef";
+
+    std::string retval(digest.size() * 2, '\0');
+    for (std::size_t idx = 0; idx < digest.size(); idx++)
+    {
+        retval[idx * 2] = hexchars[digest[idx] >> 4];
+        retval[idx * 2 + 1] = hexchars[digest[idx] & 0x0f];
+    }
+
+    return retval;
 }
 
 Block::Block(std::uint64_t index, std::string_view prevHash, Transactions&& txs)
@@ -120,6 +313,45 @@ Block::Block(std::uint64_t index, std::string_view prevHash, Transactions&& txs)
     _hash = CalculateBlockHash(*this);
 }
 
+const std::string& Block::txDigest() const
+{
+    // like the root, the digest of a block without its transactions is
+    // only known when it was computed before they were dropped
+    if (_txDigest.empty() && _hasTransactions)
+    {
+        _txDigest = (_version == HashVersion::MERKLE)
+            ? merkleRoot()
+            : GetTransactionsDigest(_hashed._txs, _version);
+    }
+
+    return _txDigest;
+}
+
+void Block::cacheDigests() const
+{
+    txDigest();
+    merkleRoot();
+}
+
+void Block::dropTransactions()
+{
+    cacheDigests();
+    _hashed._txs = Transactions{};
+    _hasTransactions = false;
+}
+
+const std::string& Block::merkleRoot() const
+{
+    // the root of a block without its transactions is only known when
+    // it was computed before they were dropped
+    if (_merkleRoot.empty() && _hasTransactions)
+    {
+        _merkleRoot = ToHexString(GetMerkleRoot(_hashed._txs));
+    }
+
+    return _merkleRoot;
+}
+
 bool Block::operator==(const Block & other) const
 {
     return _hashed._index == other._hashed._index
@@ -3,9 +3,11 @@
 #include <cstdint>
 #include <iostream>
 #include <chrono>
+#include <array>
 
 #include <nlohmann/json.hpp>
 
+#include "SHA256Kernel.h"
 #include "Transactions.h"
 #include "AshLogger.h"
 
@@ -16,6 +18,7 @@ namespace ash
 
 class Block;
 using BlockSharedPtr = std::shared_ptr<Block>;
+using BlockConstPtr = std::shared_ptr<const Block>;
 using BlockUniquePtr = std::unique_ptr<Block>;
 
 void to_json(nl::json& j, const Block& b);
@@ -34,10 +37,79 @@ std::string CalculateBlockHash(
     const std::string& previous,
     const std::string& extra);
 
+// returns true if the hex representation of `digest` starts with
+// `count` zeros, without building the hex string
+inline bool HasLeadingZeros(const HashDigest& digest, std::uint64_t count) noexcept
+{
+    if (count > digest.size() * 2)
+    {
+        return false;
+    }
+
+    const auto fullbytes = static_cast<std::size_t>(count / 2);
+    for (std::size_t idx = 0; idx < fullbytes; idx++)
+    {
+        if (digest[idx] != 0)
+        {
+            return false;
+        }
+    }
+
+    return (count % 2) == 0 || (digest[fullbytes] & 0xf0) == 0;
+}
+
+std::string ToHexString(const HashDigest& digest);
+
+//! Computes the same hash as `CalculateBlockHash()` for blocks that
+//  only differ by their nonce and time. Only the index digits come
+//  before the nonce, which never fill a SHA-256 block, so there is no
+//  midstate to save and every attempt hashes the whole message. The
+//  messages are serialized and padded once per `setTime()` instead, so
+//  each attempt only writes the nonce digits and runs the compression
+//  kernel. Several nonces can be hashed at once to use the SIMD kernels.
+//  Hashing into a `HashDigest` does not allocate.
+class BlockHasher
+{
+    const crypto::SHA256Kernel& _kernel;
+
+    std::string         _prefix;            // index
+    std::string         _tailHead;          // difficulty + data
+    std::string         _tailEnd;           // previous + extra
+    std::string         _tail;              // _tailHead + time + _tailEnd
+
+    // one padded message per lane laid out for nonces of `_digits` digits
+    std::vector<std::uint8_t>   _messages;
+    std::size_t                 _messageSize = 0;
+    std::size_t                 _digits = 0;
+
+    void prepareMessages(std::size_t digits);
+
+public:
+    BlockHasher(std::uint64_t index, 
+        std::uint64_t difficulty,
+        const std::string& data,
+        const std::string& previous,
+        const std::string& extra,
+        const crypto::SHA256Kernel& kernel = crypto::GetSHA256Kernel());
+
+    // the number of nonces the kernel prefers to hash at once
+    std::size_t lanes() const noexcept { return _kernel.lanes; }
+
+    void setTime(BlockTime time);
+
+    void hash(std::uint64_t nonce, HashDigest& digest);
+    std::string hash(std::uint64_t nonce);
+
+    // hashes the nonces `first`, `first + stride`, ... into `count`
+    // digests, where `count` is at most crypto::SHA256MaxLanes
+    void hash(std::uint64_t first, std::uint64_t stride, std::size_t count, HashDigest* digests);
+};
+
 class Block 
 {
-    friend void read_block(std::istream& stream, Block& block);
-    friend void write_block(std::ostream& stream, const Block& block);
+    friend void read_block(db::MemoryReader& stream, Block& block, std::uint32_t format);
+    friend void write_block(db::MemoryWriter& writer, const Block& block);
+    friend std::size_t encoded_size(const Block& block);
     friend void from_json(const nl::json& j, Block& b);
     friend class Miner;
 
@@ -64,12 +136,45 @@ public:
     const Transactions& transactions() const { return _hashed._txs; }
     Transactions& transactions()
     {
-        return const_cast<Transactions&>(
-            (static_cast<const Block*>(this))->transactions());
+        // the caller may change the transactions
+        _txDigest.clear();
+        _merkleRoot.clear();
+        return _hashed._txs;
     }
 
+    // the digest of the transactions that goes into the block hash, the
+    // Merkle root for MERKLE blocks and SHA-256 of the serialized 
+    // transactions otherwise. It is computed on first use and cached 
+    // until the transactions are accessed through the non-const 
+    // `transactions()`
+    const std::string& txDigest() const;
+
+    // the hex Merkle root of the transactions, cached like `txDigest()`
+    const std::string& merkleRoot() const;
+
+    // computes the transaction digest and the Merkle root up front, a
+    // block that is shared between threads has to be prepared this way
+    // so the readers never fill in the caches
+    void cacheDigests() const;
+
+    // frees the transactions of a block that can be loaded again and
+    // keeps the header, the transaction digest and the Merkle root are
+    // computed first so the block hash can still be checked and the
+    // header still carries its root
+    void dropTransactions();
+    bool hasTransactions() const noexcept { return _hasTransactions; }
+
     std::string hash() const { return _hash; }
 
+    // the transaction hashing rules the block was created with
+    HashVersion version() const { return _version; }
+    void setVersion(HashVersion version)
+    {
+        _version = version;
+        _txDigest.clear();
+        _merkleRoot.clear();
+    }
+
     std::string miner() const { return _miner; }
     void setMiner(std::string_view val) { _miner = val; }
 
@@ -94,10 +199,15 @@ private:
     };
 
     HashedData      _hashed;
+    HashVersion     _version = CURRENT_HASH_VERSION;
+    bool            _hasTransactions = true;
 
     std::string     _hash;
     std::string     _miner;
     SpdLogPtr       _logger;
+
+    mutable std::string _txDigest;
+    mutable std::string _merkleRoot;
 };
 
 } // namespace ash
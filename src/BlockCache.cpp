@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <cassert>
+
+#include "BlockCache.h"
+
+namespace ash
+{
+
+BlockCache::BlockCache(std::size_t capacity)
+    : _capacity{ std::max<std::size_t>(capacity, 1u) }
+{
+}
+
+std::size_t BlockCache::size() const
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _entries.size();
+}
+
+BlockConstPtr BlockCache::get(const std::string& hash)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    auto it = _lookup.find(hash);
+    if (it == _lookup.end())
+    {
+        return nullptr;
+    }
+
+    _entries.splice(_entries.begin(), _entries, it->second);
+    return it->second->second;
+}
+
+void BlockCache::put(BlockConstPtr block)
+{
+    assert(block);
+    auto hash = block->hash();
+
+    std::lock_guard<std::mutex> lock{_mutex};
+
+    if (auto it = _lookup.find(hash); it != _lookup.end())
+    {
+        it->second->second = std::move(block);
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return;
+    }
+
+    _entries.emplace_front(hash, std::move(block));
+    _lookup.emplace(std::move(hash), _entries.begin());
+
+    while (_entries.size() > _capacity)
+    {
+        _lookup.erase(_entries.back().first);
+        _entries.pop_back();
+    }
+}
+
+void BlockCache::clear()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _lookup.clear();
+    _entries.clear();
+}
+
+} // namespace ash
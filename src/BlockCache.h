@@ -0,0 +1,45 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Block.h"
+
+namespace ash
+{
+
+constexpr auto BlockCacheSizeDefault = 1024u;
+
+class BlockCache;
+using BlockCachePtr = std::shared_ptr<BlockCache>;
+
+//! A least recently used cache of full blocks keyed by their hash. It
+//  is shared by a chain and its snapshots so it is thread safe.
+class BlockCache final
+{
+    using Entry = std::pair<std::string, BlockConstPtr>;
+    using Entries = std::list<Entry>;
+
+    std::size_t                                         _capacity;
+    Entries                                             _entries;   // most recently used first
+    std::unordered_map<std::string, Entries::iterator>  _lookup;
+    mutable std::mutex                                  _mutex;
+
+public:
+    explicit BlockCache(std::size_t capacity);
+
+    std::size_t capacity() const noexcept { return _capacity; }
+    std::size_t size() const;
+
+    // returns nullptr when the block is not in the cache
+    BlockConstPtr get(const std::string& hash);
+
+    // adds the block and evicts the least recently used block when
+    // the cache is full
+    void put(BlockConstPtr block);
+
+    void clear();
+};
+
+} // namespace ash
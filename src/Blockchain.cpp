@@ -1,4 +1,6 @@
-#include <set>
+#include <algorithm>
+#include <limits>
+#include <utility>
 
 #include <boost/range/adaptor/indexed.hpp>
 
@@ -6,8 +8,10 @@
 #include <range/v3/view/filter.hpp>
 #include <range/v3/view/transform.hpp>
 
+#include "AshUtils.h"
 #include "CryptoUtils.h"
 #include "Blockchain.h"
+#include "ChainDatabase.h"
 
 namespace nl = nlohmann;
 
@@ -16,9 +20,9 @@ namespace ash
 
 void to_json(nl::json& j, const Blockchain& b)
 {
-    for (const auto& block : b._blocks)
+    for (std::size_t idx = 0; idx < b.size(); idx++)
     {
-        j.push_back(block);
+        j.push_back(*(b.fullBlock(idx)));
     }
 }
 
@@ -28,7 +32,7 @@ void from_json(const nl::json& j, Blockchain& b)
 
     for (const auto& jblock : j.items())
     {
-        b._blocks.push_back(jblock.value().get<Block>());
+        b.pushBlock(jblock.value().get<Block>());
     }
 }
 
@@ -70,122 +74,17 @@ void from_json(const nlohmann::json& j, AddressLedger& ledger)
 
 UnspentTxOuts GetUnspentTxOuts(const Blockchain& chain, const std::string& address)
 {
-    auto cmp = 
-        [](const UnspentTxOut& a, const UnspentTxOut& b)
-        {
-            return std::hash<UnspentTxOut>{}(a) < std::hash<UnspentTxOut>{}(b);
-        };
-
-    std::set<UnspentTxOut, decltype(cmp)> outs(cmp);
-
-    for (const auto& block : chain)
-    {
-        for (const auto& txitem : block.transactions() | boost::adaptors::indexed())
-        {
-            const auto& tx = txitem.value();
-
-            assert(tx.txIns().size() > 0);
-            assert(tx.txOuts().size() > 0);
-
-            for (const auto& txoutitem : tx.txOuts() | boost::adaptors::indexed())
-            {
-                const auto& txout = txoutitem.value();
-                if (address.size() > 0 && txout.address() != address)
-                {
-                    continue;
-                }
-
-                outs.insert({
-                    block.index(),
-                    static_cast<std::uint64_t>(txitem.index()),
-                    static_cast<std::uint64_t>(txoutitem.index()),
-                    txout.address(), 
-                    txout.amount()});
-            }
-
-            // if this is a coinbase transaction then we do not need
-            // to process the TxIns
-            if (tx.isCoinbase())
-            {
-                continue;
-            }
-
-            for (const auto& txin : tx.txIns())
-            {
-                auto it = std::find_if(outs.begin(), outs.end(),
-                   [txin = txin](const UnspentTxOut& utxout)
-                   {
-                        return (txin.txOutPt().blockIndex == utxout.blockIndex)
-                            && (txin.txOutPt().txIndex == utxout.txIndex)
-                            && (txin.txOutPt().txOutIndex == utxout.txOutIndex);
-                   });
-
-                if (it != outs.end())
-                {
-                    outs.erase(it);
-                }
-            }
-        }
-    }
-
-    UnspentTxOuts retval;
-    std::move(outs.begin(), outs.end(), std::back_inserter(retval));
-
-    return retval;
+    return chain.unspentTxOuts(address);
 }
 
 AddressLedger GetAddressLedger(const Blockchain& chain, const std::string& address)
 {
-    ash::AddressLedger ledger;
-
-    for (const auto& block : chain)
-    {
-        const auto fullblock = ash::GetBlockDetails(chain, block.index());
-        for (const auto& tx : fullblock.transactions())
-        {
-            bool debit = false;
-            assert(tx.txOuts().size() > 0);
-            
-            for (const auto& txout : tx.txOuts())
-            {
-                if (txout.address() == address)
-                {
-                    ledger.push_back(
-                        LedgerInfo{ block.index(), tx.id(), block.time(), txout.amount() });
-
-                    break;
-                }
-            }
-
-            // this is a debit for the address so pop the last ledger entry, accumulate
-            // the total of all the TxIns and put it back to the ledger
-            assert(tx.txIns().size() > 0);
-            assert(tx.txIns().at(0).txOutPt().address.has_value());
-
-            if (!tx.isCoinbase()
-                && *(tx.txIns().at(0).txOutPt().address) == address)
-            {
-                double txInTotal = std::accumulate(
-                    tx.txIns().begin(), tx.txIns().end(), 0.0,
-                    [](auto accum, const ash::TxIn& txin)
-                    {
-                        return accum + *(txin.txOutPt().amount);
-                    });
-
-                auto amount = txInTotal - ledger.back().amount;
-                ledger.pop_back();
-                ledger.push_back(
-                    LedgerInfo{ block.index(), tx.id(), block.time(), amount * -1.0 });
-            }
-        }
-    }
-
-    return ledger;
+    return chain.addressLedger(address);
 }
 
 double GetAddressBalance(const Blockchain& chain, const std::string& address)
 {
-    const auto ledger = ash::GetAddressLedger(chain, address);
+    const auto& ledger = chain.addressLedger(address);
     return std::accumulate(
         ledger.begin(), ledger.end(), 0.0,
         [](auto accum, const auto& entry)
@@ -253,18 +152,17 @@ std::tuple<TxResult, ash::Transaction> CreateTransaction(Blockchain& chain, std:
     return { TxResult::SUCCESS, tx };
 }
 
-// TODO: The implementation of this should be improved to be faster
-// perhaps with a persisted index or something
 std::optional<TxPoint> FindTransaction(const Blockchain& chain, std::string_view txid)
 {
-    for (const auto& block: chain)
+    for (std::size_t idx = 0; idx < chain.size(); idx++)
     {
-        for (const auto& txitem : block.transactions() | boost::adaptors::indexed())
+        const auto block = chain.fullBlock(idx);
+        for (const auto& txitem : block->transactions() | boost::adaptors::indexed())
         {
             const auto& tx = txitem.value();
             if (tx.id() == txid)
             {
-                return TxPoint{ block.index(), txitem.index() };
+                return TxPoint{ block->index(), txitem.index() };
             }
         }
     }
@@ -272,10 +170,33 @@ std::optional<TxPoint> FindTransaction(const Blockchain& chain, std::string_view
     return {};
 }
 
+std::optional<TxPoint> FindTransaction(const Blockchain& chain, const ChainDatabase& database, std::string_view txid)
+{
+    if (const auto txpt = database.findTransaction(txid); txpt.has_value())
+    {
+        const auto [blockIndex, txIndex] = *txpt;
+        if (blockIndex < chain.size())
+        {
+            const auto block = chain.fullBlock(blockIndex);
+            if (txIndex < block->transactions().size()
+                && block->transactions().at(txIndex).id() == txid)
+            {
+                return txpt;
+            }
+        }
+    }
+    else if (database.txIndexReady())
+    {
+        return {};
+    }
+
+    return FindTransaction(chain, txid);
+}
+
 Block GetBlockDetails(const Blockchain& chain, std::size_t index)
 {
     const auto chainsize = chain.size();
-    Block retblock = chain.at(index); // block copy!
+    Block retblock = *(chain.fullBlock(index)); // block copy!
 
     // loops through the transactions of the block we're
     // interested in
@@ -288,7 +209,14 @@ Block GetBlockDetails(const Blockchain& chain, std::size_t index)
             const auto& txpt = txin.txOutPt();
             assert(txpt.blockIndex < chainsize);
 
-            const auto& txs = chain.at(txpt.blockIndex).transactions();
+            // the TxOuts of a pruned block are no longer known
+            const auto txblock = chain.fullBlock(txpt.blockIndex);
+            if (!txblock->hasTransactions())
+            {
+                continue;
+            }
+
+            const auto& txs = txblock->transactions();
             assert(txpt.txIndex < txs.size());
             const auto& tx = txs.at(txpt.txIndex);
             assert(txpt.txOutIndex < tx.txOuts().size());
@@ -302,11 +230,26 @@ Block GetBlockDetails(const Blockchain& chain, std::size_t index)
     return retblock;
 }
 
+bool IsValidPeerChain(const Blockchain& chain)
+{
+    // the hash of a pruned block is checked with the transaction digest
+    // the peer sent, so it proves nothing about the transactions
+    const auto pruned = std::find_if(chain.begin(), chain.end(),
+        [](const Block& block)
+        {
+            return !block.hasTransactions();
+        });
+
+    return chain.size() > 0
+        && pruned == chain.end()
+        && chain.isValidChain();
+}
+
 //*** Blockchain
 Blockchain::Blockchain()
     : _logger(ash::initializeLogger("Blockchain"))
 {
-    // nothing to do
+    _cumDifficulty.push_back(0);
 }
 
 bool Blockchain::addNewBlock(const Block& block)
@@ -321,16 +264,397 @@ bool Blockchain::addNewBlock(const Block& block, bool checkPreviousBlock)
         return false;
     }
     else if (checkPreviousBlock
-        && block.previousHash() != _blocks.back().hash())
+        && block.previousHash() != back().hash())
     {
         return false;
     }
 
-    _blocks.push_back(block);
+    pushBlock(block);
 
     return true;
 }
 
+void Blockchain::clear()
+{
+    _blocks.clear();
+    _ledgers.clear();
+    _cumDifficulty.clear();
+    _cumDifficulty.push_back(0);
+    _unspent.clear();
+    _addressUnspent.clear();
+    _spentTxOuts.clear();
+    _bodiesFrom = 0;
+}
+
+void Blockchain::resize(std::size_t size)
+{
+    while (_blocks.size() > size)
+    {
+        popBlock();
+    }
+
+    while (_blocks.size() < size)
+    {
+        pushBlock(Block{});
+    }
+}
+
+UnspentTxOuts Blockchain::unspentTxOuts(const std::string& address) const
+{
+    UnspentTxOuts retval;
+
+    auto addOut = 
+        [&retval](const TxOutPoint& pt, const TxOut& txout)
+        {
+            retval.push_back({ pt.blockIndex, pt.txIndex, pt.txOutIndex,
+                txout.address(), txout.amount() });
+        };
+
+    if (address.empty())
+    {
+        retval.reserve(_unspent.size());
+        for (const auto& [pt, txout] : _unspent)
+        {
+            addOut(pt, txout);
+        }
+    }
+    else if (const auto* points = _addressUnspent.find(address); points)
+    {
+        retval.reserve(points->size());
+        for (const auto& pt : *points)
+        {
+            addOut(pt, *_unspent.find(pt));
+        }
+    }
+
+    std::sort(retval.begin(), retval.end());
+    return retval;
+}
+
+const AddressLedger& Blockchain::addressLedger(const std::string& address) const
+{
+    static const AddressLedger empty;
+
+    const auto* ledger = _ledgers.find(address);
+    return ledger ? *ledger : empty;
+}
+
+// An address is credited with the first of its TxOuts in a transaction.
+// The sender of a transaction, the address of its first TxIn, is debited
+// with the TxIns it spent less the change it got back.
+template<typename Func>
+void Blockchain::forEachLedgerEntry(const Block& block, Func func) const
+{
+    // the TxOuts a block spends are usually still unspent, so the 
+    // older blocks only have to be loaded for the odd double spend
+    auto findTxOut = 
+        [this, &block](const TxOutPoint& pt) -> std::optional<TxOut>
+        {
+            if (pt.blockIndex != block.index())
+            {
+                if (const auto* txout = _unspent.find(pt); txout)
+                {
+                    return *txout;
+                }
+            }
+
+            BlockConstPtr owner;
+            const Transactions* txs = nullptr;
+            if (pt.blockIndex == block.index())
+            {
+                txs = &(block.transactions());
+            }
+            else if (pt.blockIndex < _blocks.size())
+            {
+                owner = fullBlock(pt.blockIndex);
+                txs = &(owner->transactions());
+            }
+
+            if (!txs
+                || pt.txIndex >= txs->size()
+                || pt.txOutIndex >= txs->at(pt.txIndex).txOuts().size())
+            {
+                return {};
+            }
+
+            return txs->at(pt.txIndex).txOuts().at(pt.txOutIndex);
+        };
+
+    for (const auto& tx : block.transactions())
+    {
+        std::optional<TxOut> sender;
+        double txInTotal = 0.0;
+
+        if (!tx.isCoinbase())
+        {
+            sender = findTxOut(tx.txIns().front().txOutPt());
+            for (const auto& txin : tx.txIns())
+            {
+                if (const auto txout = findTxOut(txin.txOutPt()); txout)
+                {
+                    txInTotal += txout->amount();
+                }
+            }
+        }
+
+        std::optional<double> change;
+        std::unordered_set<std::string> credited;
+        for (const auto& txout : tx.txOuts())
+        {
+            if (!credited.insert(txout.address()).second)
+            {
+                continue;
+            }
+
+            if (sender && txout.address() == sender->address())
+            {
+                change = txout.amount();
+                continue;
+            }
+
+            func(txout.address(), 
+                LedgerInfo{ block.index(), tx.id(), block.time(), txout.amount() });
+        }
+
+        if (sender)
+        {
+            const auto amount = txInTotal - change.value_or(0.0);
+            func(sender->address(), 
+                LedgerInfo{ block.index(), tx.id(), block.time(), amount * -1.0 });
+        }
+    }
+}
+
+void Blockchain::pushBlock(Block block)
+{
+    applyBlock(block);
+    appendBlock(std::move(block));
+}
+
+void Blockchain::appendBlock(Block block)
+{
+    // the blocks are shared with the chain's snapshots
+    block.cacheDigests();
+    _blocks.push_back(std::move(block));
+    dropBodies();
+}
+
+void Blockchain::replayState()
+{
+    _ledgers.clear();
+    _cumDifficulty.clear();
+    _cumDifficulty.push_back(0);
+    _unspent.clear();
+    _addressUnspent.clear();
+    _spentTxOuts.clear();
+
+    for (std::size_t idx = 0; idx < _blocks.size(); idx++)
+    {
+        applyBlock(*fullBlock(idx));
+    }
+}
+
+void Blockchain::pruneState(std::size_t count)
+{
+    count = std::min(count, _spentTxOuts.size());
+    for (std::size_t idx = 0; idx < count; idx++)
+    {
+        // only the segments that still have spent TxOuts are copied
+        if (!std::as_const(_spentTxOuts)[idx].empty())
+        {
+            UnspentTxOuts{}.swap(_spentTxOuts[idx]);
+        }
+    }
+}
+
+void Blockchain::applyBlock(const Block& block)
+{
+    forEachLedgerEntry(block,
+        [this](const std::string& address, LedgerInfo&& entry)
+        {
+            _ledgers[address].push_back(std::move(entry));
+        });
+
+    auto& spent = _spentTxOuts.emplace_back();
+
+    for (const auto& txitem : block.transactions() | boost::adaptors::indexed())
+    {
+        const auto& tx = txitem.value();
+        for (const auto& txoutitem : tx.txOuts() | boost::adaptors::indexed())
+        {
+            addUnspent({ block.index(),
+                static_cast<std::uint64_t>(txitem.index()),
+                static_cast<std::uint64_t>(txoutitem.index()) },
+                txoutitem.value());
+        }
+
+        // if this is a coinbase transaction then we do not need
+        // to process the TxIns
+        if (tx.isCoinbase())
+        {
+            continue;
+        }
+
+        for (const auto& txin : tx.txIns())
+        {
+            const auto& pt = txin.txOutPt();
+            if (auto txout = removeUnspent(pt); txout.has_value())
+            {
+                spent.push_back({ pt.blockIndex, pt.txIndex, pt.txOutIndex,
+                    txout->address(), txout->amount() });
+            }
+        }
+    }
+
+    // 2^difficulty, saturating instead of overflowing
+    const auto difficulty = block.difficulty();
+    const auto work = difficulty < 64
+        ? (std::uint64_t{1} << difficulty)
+        : std::numeric_limits<std::uint64_t>::max();
+
+    const auto total = std::as_const(_cumDifficulty).back();
+    _cumDifficulty.push_back(
+        total > std::numeric_limits<std::uint64_t>::max() - work
+            ? std::numeric_limits<std::uint64_t>::max()
+            : total + work);
+}
+
+void Blockchain::popBlock()
+{
+    assert(_blocks.size() > 0);
+    assert(_blocks.size() == _spentTxOuts.size());
+
+    // restore what the block spent before removing what it created,
+    // since it may have spent its own TxOuts
+    for (const auto& pt : std::as_const(_spentTxOuts).back())
+    {
+        addUnspent(pt, TxOut{ *(pt.address), *(pt.amount) });
+    }
+
+    const auto blockptr = fullBlock(_blocks.size() - 1);
+    const auto& block = *blockptr;
+    for (const auto& txitem : block.transactions() | boost::adaptors::indexed())
+    {
+        for (auto idx = 0u; idx < txitem.value().txOuts().size(); idx++)
+        {
+            removeUnspent({ block.index(),
+                static_cast<std::uint64_t>(txitem.index()), idx });
+        }
+    }
+
+    forEachLedgerEntry(block,
+        [this](const std::string& address, const LedgerInfo&)
+        {
+            auto* ledger = _ledgers.modify(address);
+            assert(ledger && !ledger->empty());
+            ledger->pop_back();
+            if (ledger->empty())
+            {
+                _ledgers.erase(address);
+            }
+        });
+
+    _spentTxOuts.pop_back();
+    _cumDifficulty.pop_back();
+    _blocks.pop_back();
+    _bodiesFrom = std::min(_bodiesFrom, _blocks.size());
+}
+
+void Blockchain::dropBodies()
+{
+    if (!_reader)
+    {
+        return;
+    }
+
+    // a block keeps its transactions until the reader has it, which
+    // for a new block is after it is written to the database
+    while (_bodiesFrom < _blocks.size()
+        && _reader->hasBlock(_bodiesFrom, at(_bodiesFrom).hash()))
+    {
+        _blocks[_bodiesFrom].dropTransactions();
+        _bodiesFrom++;
+    }
+}
+
+BlockConstPtr Blockchain::fullBlock(std::size_t index) const
+{
+    // blocks do not move, so share the block without owning it, a
+    // pruned block of a chain without a reader only has its header
+    const auto& block = _blocks.at(index);
+    if (block.hasTransactions() || !_reader)
+    {
+        return BlockConstPtr{ BlockConstPtr{}, &block };
+    }
+
+    assert(_cache);
+    const auto hash = block.hash();
+    if (auto cached = _cache->get(hash); cached)
+    {
+        return cached;
+    }
+
+    auto loaded = _reader->readBlock(index);
+    if (!loaded.has_value() || loaded->hash() != hash)
+    {
+        throw std::logic_error(fmt::format("could not load block #{} from the database", index));
+    }
+
+    // the cache shares the block between threads
+    loaded->cacheDigests();
+    auto retval = std::make_shared<const Block>(std::move(*loaded));
+    _cache->put(retval);
+    return retval;
+}
+
+void Blockchain::setBlockReader(const BlockReader* reader, std::size_t cacheSize)
+{
+    if (!reader)
+    {
+        // bring back the transactions of every block
+        for (std::size_t idx = 0; idx < _bodiesFrom; idx++)
+        {
+            _blocks[idx] = *fullBlock(idx);
+        }
+
+        _reader = nullptr;
+        _cache.reset();
+        _bodiesFrom = 0;
+        return;
+    }
+
+    _reader = reader;
+    _cache = std::make_shared<BlockCache>(cacheSize);
+    dropBodies();
+}
+
+void Blockchain::addUnspent(const TxOutPoint& pt, const TxOut& txout)
+{
+    removeUnspent(pt);
+    _addressUnspent[txout.address()].insert(pt);
+    _unspent.emplace(pt, txout);
+}
+
+std::optional<TxOut> Blockchain::removeUnspent(const TxOutPoint& pt)
+{
+    auto txout = _unspent.extract(pt);
+    if (!txout.has_value())
+    {
+        return {};
+    }
+
+    if (auto* points = _addressUnspent.modify(txout->address()); points)
+    {
+        points->erase(pt);
+        if (points->empty())
+        {
+            _addressUnspent.erase(txout->address());
+        }
+    }
+
+    return txout;
+}
+
 bool Blockchain::isValidBlockPair(std::size_t idx) const
 {
     if (idx > _blocks.size() || idx < 1)
@@ -366,21 +690,13 @@ bool Blockchain::isValidChain() const
 
 std::uint64_t Blockchain::cumDifficulty() const
 {
-    return cumDifficulty(_blocks.size() - 1);
+    return _blocks.empty() ? 0 : cumDifficulty(_blocks.size() - 1);
 }
 
 std::uint64_t Blockchain::cumDifficulty(std::size_t idx) const
 {
-    std::uint64_t total = 0;
-    auto lastBlockIt = std::next(_blocks.begin(), idx);
-
-    for (auto current = _blocks.begin(); current < lastBlockIt; current++)
-    {
-        total += static_cast<std::uint64_t>
-            (std::pow(2u, current->difficulty()));
-    }
-
-    return total;
+    assert(idx < _cumDifficulty.size());
+    return _cumDifficulty.at(idx);
 }
 
 std::size_t Blockchain::reQueueTransactions(Block& block)
@@ -390,7 +706,7 @@ std::size_t Blockchain::reQueueTransactions(Block& block)
     for (const auto& tx : block.transactions())
     {
         if (tx.isCoinbase()) continue;
-        _txQueue.push(tx); // copy!!
+        txQueue().push(tx); // copy!!
         count++;
     }
 
@@ -427,12 +743,26 @@ std::uint64_t Blockchain::getAdjustedDifficulty()
 
 std::size_t Blockchain::transactionQueueSize() const noexcept
 {
-    return _txQueue.size();
+    return _txQueue ? _txQueue->size() : 0;
 }
 
 void Blockchain::queueTransaction(Transaction&& tx)
 {
-    _txQueue.push(std::move(tx));
+    txQueue().push(std::move(tx));
+}
+
+std::queue<Transaction>& Blockchain::txQueue()
+{
+    if (!_txQueue)
+    {
+        _txQueue = std::make_shared<std::queue<Transaction>>();
+    }
+    else if (!utils::IsSoleOwner(_txQueue))
+    {
+        _txQueue = std::make_shared<std::queue<Transaction>>(*_txQueue);
+    }
+
+    return *_txQueue;
 }
 
 BlockUniquePtr Blockchain::createUnminedBlock(const std::string& coinbasewallet)
@@ -442,12 +772,13 @@ BlockUniquePtr Blockchain::createUnminedBlock(const std::string& coinbasewallet)
     ash::Transactions txs;
     txs.push_back(ash::CreateCoinbaseTransaction(newblockidx, coinbasewallet));
 
-    while (!_txQueue.empty())
+    auto& queue = txQueue();
+    while (!queue.empty())
     {
-        auto& tx = _txQueue.front();
+        auto& tx = queue.front();
         tx.calcuateId(newblockidx);
         txs.push_back(std::move(tx));
-        _txQueue.pop();
+        queue.pop();
     }
 
     return std::make_unique<Block>(newblockidx, this->back().hash(), std::move(txs));
@@ -3,10 +3,17 @@
 #include <cstdint>
 #include <vector>
 #include <queue>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "Transactions.h"
 #include "Settings.h"
 #include "Block.h"
+#include "SegmentedVector.h"
+#include "ShardedMap.h"
+#include "BlockCache.h"
 #include "AshLogger.h"
 
 namespace ash
@@ -23,6 +30,8 @@ constexpr auto BLOCK_INTERVAL   = 10u; // in blocks
 class Blockchain;
 using BlockChainPtr = std::unique_ptr<Blockchain>;
 
+class ChainDatabase;
+
 struct LedgerInfo;
 using AddressLedger = std::vector<LedgerInfo>;
 
@@ -47,10 +56,33 @@ std::tuple<TxResult, ash::Transaction> CreateTransaction(Blockchain& chain, std:
 using TxPoint = std::tuple<std::uint64_t, std::uint64_t>;
 std::optional<TxPoint> FindTransaction(const Blockchain& chain, std::string_view txid);
 
+// looks `txid` up in the database's txid index and only walks the chain
+// when the index is still being rebuilt or is out of date
+std::optional<TxPoint> FindTransaction(const Blockchain& chain, const ChainDatabase& database, std::string_view txid);
+
 // TODO: should this return an optional?
 // fills in the TxIn TxPoint info for all the Transactions in the Block
 Block GetBlockDetails(const Blockchain& chain, std::size_t index);
 
+// true for a chain from a peer that can replace or extend the local
+// chain, which has to be valid and has to have the transactions of
+// every block since the chain state is built from them. Only the
+// local database and the display of a pruned chain decode blocks
+// without their transactions.
+bool IsValidPeerChain(const Blockchain& chain);
+
+//! Where a chain that only keeps block headers loads its blocks from,
+//  the reader has to be safe to call from several threads
+class BlockReader
+{
+public:
+    virtual ~BlockReader() = default;
+
+    // true when the block at `index` with `hash` can be read back
+    virtual bool hasBlock(std::size_t index, std::string_view hash) const = 0;
+    virtual std::optional<Block> readBlock(std::size_t index) const = 0;
+};
+
 struct LedgerInfo
 {
     std::uint64_t   blockIdx;
@@ -74,20 +106,78 @@ struct LedgerInfo
 //  client handles synchronization
 class Blockchain final
 {
-    std::vector<Block>          _blocks;
-    UnspentTxOuts               _unspentTxOuts;
-    std::queue<Transaction>     _txQueue; // transactions waiting to be mined by this miner
+    using AddressUnspent = ShardedMap<std::string, std::unordered_set<TxOutPoint>>;
+
+    // blocks never move once they are in the chain, so references
+    // to a block stay valid while more blocks are appended. Copies of
+    // the chain share the blocks and the state derived from them, so
+    // copying the chain does not copy it block by block.
+    SegmentedVector<Block>      _blocks;
+    // transactions waiting to be mined by this miner, copies share the
+    // queue until one of them changes it so a snapshot does not copy it
+    std::shared_ptr<std::queue<Transaction>>    _txQueue;
     SpdLogPtr                   _logger;
 
+    // the unspent TxOuts of the chain and the unspent TxOuts of each 
+    // address, updated as blocks are added and removed so queries do
+    // not have to walk the chain
+    ShardedMap<TxOutPoint, TxOut>   _unspent;
+    AddressUnspent                  _addressUnspent;
+
+    // the TxOuts each block spent so the block can be rolled back
+    SegmentedVector<UnspentTxOuts>  _spentTxOuts;
+
+    // the ledger of each address in chain order
+    ShardedMap<std::string, AddressLedger>  _ledgers;
+
+    // _cumDifficulty[n] is the total work of the first n blocks
+    SegmentedVector<std::uint64_t>  _cumDifficulty;
+
+    // when there is a reader the blocks before _bodiesFrom only keep
+    // their headers and their transactions are loaded through the cache
+    const BlockReader*          _reader = nullptr;
+    BlockCachePtr               _cache;
+    std::size_t                 _bodiesFrom = 0;
+
     friend class ChainDatabase;
     friend void to_json(nl::json& j, const Blockchain& b);
     friend void from_json(const nl::json& j, Blockchain& b);
 
+    void pushBlock(Block block);
+    void popBlock();
+
+    // adds what `block` creates and spends to the unspent TxOuts, the
+    // ledgers and the total work without adding the block
+    void applyBlock(const Block& block);
+
+    // adds the block without updating the state derived from the 
+    // blocks, for blocks that are covered by a restored snapshot
+    void appendBlock(Block block);
+
+    // rebuilds the state derived from the blocks by replaying them
+    void replayState();
+
+    // frees what the first `count` blocks spent, for blocks whose 
+    // transactions were pruned and that cannot be rolled back
+    void pruneState(std::size_t count);
+
+    // the queue of this chain only, copied first when a copy shares it
+    std::queue<Transaction>& txQueue();
+
+    void dropBodies();
+    void addUnspent(const TxOutPoint& pt, const TxOut& txout);
+    std::optional<TxOut> removeUnspent(const TxOutPoint& pt);
+
+    // calls `func(address, entry)` for the ledger entries of `block`
+    template<typename Func>
+    void forEachLedgerEntry(const Block& block, Func func) const;
+
 public:
-    using iterator = std::vector<Block>::iterator;
+    using iterator = SegmentedVector<Block>::const_iterator;
 
     Blockchain();
 
+    Blockchain(const Blockchain&) = default;
     Blockchain(Blockchain&&) = default;
     Blockchain& operator=(const Blockchain&) = default;
     
@@ -126,21 +216,30 @@ public:
         return _blocks.size(); 
     }
 
-    void clear()
-    {
-        _blocks.clear();
-    }
+    void clear();
 
-    void resize(std::size_t size)
-    {
-        _blocks.resize(size);
-    }
+    // shrinking the chain rolls the unspent TxOuts back
+    void resize(std::size_t size);
 
     auto at(std::size_t index) const -> decltype(_blocks.at(index))
     {
         return _blocks.at(index);
     }
 
+    // the block at `index` with its transactions, which is loaded from
+    // the reader when the chain only keeps the block's header. A block
+    // that is in memory is not copied, so the pointer is only valid 
+    // until the chain is changed. Without a reader a pruned block is
+    // returned with only its header.
+    BlockConstPtr fullBlock(std::size_t index) const;
+
+    // keeps only the headers of the blocks `reader` has, now and as
+    // blocks are added, and loads their transactions on demand through
+    // a cache of `cacheSize` blocks
+    void setBlockReader(const BlockReader* reader, std::size_t cacheSize = BlockCacheSizeDefault);
+    bool headersOnly() const noexcept { return _reader != nullptr; }
+
+    // only for blocks that have their transactions in memory
     const auto& txAt(std::size_t blockIndex, std::size_t txIndex) const
     {
         assert(blockIndex < size());
@@ -150,10 +249,23 @@ public:
 
     auto& txAt(std::size_t blockIndex, std::size_t txIndex)
     {
-        return const_cast<Transaction&>(
-                static_cast<const Blockchain&>(*this).txAt(blockIndex,txIndex));
+        assert(blockIndex < size());
+        assert(txIndex < at(blockIndex).transactions().size());
+
+        // go through the non-const accessor so the block's cached
+        // transaction digest is invalidated, the unspent TxOuts are
+        // not updated
+        return _blocks.at(blockIndex).transactions().at(txIndex);
     }
 
+    // the unspent TxOuts of the chain or of `address` ordered by
+    // their location in the chain
+    UnspentTxOuts unspentTxOuts(const std::string& address = {}) const;
+
+    // the ledger entries of `address`, which is empty for an 
+    // address that is not in the chain
+    const AddressLedger& addressLedger(const std::string& address) const;
+
     bool addNewBlock(const Block& block);
     bool addNewBlock(const Block& block, bool checkPreviousBlock);
     BlockUniquePtr createUnminedBlock(const std::string& coinbasewallet);
@@ -161,6 +273,8 @@ public:
     bool isValidBlockPair(std::size_t idx) const;
     bool isValidChain() const;
 
+    // the total work of the blocks before `idx`, where each block
+    // counts 2^difficulty
     std::uint64_t cumDifficulty() const;
     std::uint64_t cumDifficulty(std::size_t idx) const;
     std::uint64_t getAdjustedDifficulty();
@@ -0,0 +1,157 @@
+#include <array>
+#include <cstring>
+
+#include "CRC32C.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ASH_CRC32C_X86 1
+#endif
+
+#ifdef ASH_CRC32C_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ASH_TARGET(x)
+#else
+#include <cpuid.h>
+#define ASH_TARGET(x) __attribute__((target(x)))
+#endif
+#include <nmmintrin.h>
+#endif
+
+namespace ash
+{
+
+namespace crypto
+{
+
+namespace
+{
+
+// the reflected Castagnoli polynomial
+constexpr std::uint32_t Polynomial = 0x82f63b78;
+
+constexpr std::array<std::uint32_t, 256> MakeTable()
+{
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t idx = 0; idx < table.size(); idx++)
+    {
+        auto crc = idx;
+        for (auto bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? Polynomial : 0);
+        }
+
+        table[idx] = crc;
+    }
+
+    return table;
+}
+
+constexpr auto Table = MakeTable();
+
+std::uint32_t ExtendTable(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+{
+    crc = ~crc;
+    for (std::size_t idx = 0; idx < size; idx++)
+    {
+        crc = Table[(crc ^ data[idx]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+#ifdef ASH_CRC32C_X86
+
+// the SSE 4.2 CRC32 instruction computes CRC-32C, 8 bytes at a time
+// on 64-bit builds
+ASH_TARGET("sse4.2")
+std::uint32_t ExtendSse42(std::uint32_t crc, const std::uint8_t* data, std::size_t size)
+{
+    crc = ~crc;
+
+#if defined(__x86_64__) || defined(_M_X64)
+    std::uint64_t crc64 = crc;
+    for (; size >= sizeof(std::uint64_t); size -= sizeof(std::uint64_t), data += sizeof(std::uint64_t))
+    {
+        std::uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = static_cast<std::uint32_t>(crc64);
+#endif
+
+    for (; size >= sizeof(std::uint32_t); size -= sizeof(std::uint32_t), data += sizeof(std::uint32_t))
+    {
+        std::uint32_t word;
+        std::memcpy(&word, data, sizeof(word));
+        crc = _mm_crc32_u32(crc, word);
+    }
+
+    for (; size > 0; size--, data++)
+    {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+
+    return ~crc;
+}
+
+bool CpuSupportsSse42()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    const auto ecx = static_cast<std::uint32_t>(info[2]);
+#else
+    std::uint32_t eax = 0;
+    std::uint32_t ebx = 0;
+    std::uint32_t ecx = 0;
+    std::uint32_t edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+#endif
+    return (ecx & (1u << 20)) != 0;
+}
+
+#endif // ASH_CRC32C_X86
+
+constexpr CRC32CKernel TableKernel{ "table", &ExtendTable };
+
+#ifdef ASH_CRC32C_X86
+constexpr CRC32CKernel Sse42Kernel{ "sse4.2", &ExtendSse42 };
+#endif
+
+} // namespace
+
+std::vector<const CRC32CKernel*> GetSupportedCRC32CKernels()
+{
+    std::vector<const CRC32CKernel*> retval{ &TableKernel };
+
+#ifdef ASH_CRC32C_X86
+    static const bool sse42 = CpuSupportsSse42();
+    if (sse42)
+    {
+        retval.push_back(&Sse42Kernel);
+    }
+#endif
+
+    return retval;
+}
+
+const CRC32CKernel& GetCRC32CKernel()
+{
+    static const CRC32CKernel& kernel = *(GetSupportedCRC32CKernels().back());
+    return kernel;
+}
+
+std::uint32_t CRC32C(std::string_view data)
+{
+    return GetCRC32CKernel().extend(0,
+        reinterpret_cast<const std::uint8_t*>(data.data()), data.size());
+}
+
+} // namespace ash::crypto
+
+} // namespace ash
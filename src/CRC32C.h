@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace ash
+{
+
+namespace crypto
+{
+
+//! A CRC-32C (Castagnoli) implementation. `extend` continues `crc`,
+//  the CRC of the data before `data`, which is 0 for the first data.
+struct CRC32CKernel
+{
+    std::string_view    name;
+
+    std::uint32_t (*extend)(std::uint32_t crc, const std::uint8_t* data, std::size_t size);
+};
+
+// the fastest kernel this CPU supports, selected once with CPUID
+const CRC32CKernel& GetCRC32CKernel();
+
+// every kernel this CPU supports, the portable table kernel is
+// always first and the preferred kernel is last
+std::vector<const CRC32CKernel*> GetSupportedCRC32CKernels();
+
+// the CRC-32C of `data` with the fastest kernel
+std::uint32_t CRC32C(std::string_view data);
+
+} // namespace ash::crypto
+
+} // namespace ash
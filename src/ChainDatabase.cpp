@@ -1,3 +1,13 @@
+#include <condition_variable>
+#include <deque>
+#include <exception>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "AshUtils.h"
+#include "CRC32C.h"
 #include "Transactions.h"
 #include "Blockchain.h"
 #include "ChainDatabase.h"
@@ -5,131 +15,297 @@
 namespace ash
 {
 
-void write_data(std::ostream& stream, const TxOutPoint& pt)
+constexpr std::string_view DatabaseFile = "chain.ashdb";
+constexpr std::string_view DatabaseMagic = "ASHCHAIN";
+
+// the database file starts with DatabaseMagic and the format, files 
+// without the magic are the legacy format that has no block versions.
+// Format 2 records are the block version followed by the block, format
+// 3 frames that with its length in front and its CRC32C after it.
+constexpr std::uint32_t LegacyDatabaseFormat = 1;
+constexpr std::uint32_t VersionedDatabaseFormat = 2;
+constexpr std::uint32_t DatabaseFormat = 3;
+constexpr std::uint64_t DatabaseHeaderSize = DatabaseMagic.size() + sizeof(std::uint32_t);
+
+// a pruned block has this bit set in its version and is stored with the
+// digest of its transactions in place of the transactions, so its hash
+// can still be checked
+constexpr std::uint32_t PrunedBlockFlag = 0x80000000u;
+
+// the index file is IndexMagic and the format followed by the segment,
+// offset, length and hash of each record in the segment files
+constexpr std::string_view IndexFile = "chain.ashidx";
+constexpr std::string_view IndexMagic = "ASHINDEX";
+constexpr std::uint32_t IndexFormat = 2;
+
+// the manifest is ManifestMagic and the format followed by the names 
+// of the segment files in order, the first segment is DatabaseFile so
+// a database from before segments is a single segment
+constexpr std::string_view ManifestFile = "chain.ashman";
+constexpr std::string_view ManifestMagic = "ASHMANIF";
+constexpr std::uint32_t ManifestFormat = 1;
+
+// a snapshot is SnapshotMagic and the format, the number of blocks it
+// covers and the hash of the last of them, the unspent TxOuts, the 
+// TxOuts each block spent, the ledgers and the total work of those 
+// blocks, and the CRC32C of everything before it
+constexpr std::string_view SnapshotMagic = "ASHSNAPS";
+constexpr std::uint32_t SnapshotFormat = 1;
+constexpr std::string_view SnapshotPrefix = "chain.";
+constexpr std::string_view SnapshotSuffix = ".ashsnap";
+
+// an older snapshot is kept in case the newest one cannot be used
+constexpr std::size_t SnapshotsKept = 2;
+
+void write_header(std::ostream& stream)
+{
+    stream.write(DatabaseMagic.data(), DatabaseMagic.size());
+    ash::db::write_data<std::uint32_t>(stream, DatabaseFormat);
+}
+
+std::uint32_t read_header(db::MemoryReader& stream)
+{
+    const auto magic = stream.view(DatabaseMagic.size());
+    if (!stream || magic != DatabaseMagic)
+    {
+        stream.clear();
+        stream.seek(0);
+        return LegacyDatabaseFormat;
+    }
+
+    std::uint32_t format;
+    ash::db::read_data(stream, format);
+    if (format > DatabaseFormat)
+    {
+        throw std::logic_error(fmt::format("unsupported database format {}", format));
+    }
+
+    return format;
+}
+
+constexpr std::size_t encoded_size(const TxOutPoint&)
 {
-    ash::db::write_data(stream, pt.blockIndex);
-    ash::db::write_data(stream, pt.txIndex);
-    ash::db::write_data(stream, pt.txOutIndex);
+    return sizeof(TxOutPoint::blockIndex) + sizeof(TxOutPoint::txIndex) + sizeof(TxOutPoint::txOutIndex);
 }
 
-void write_data(std::ostream& stream, const TxIn& tx)
+std::size_t encoded_size(const TxIn& txin)
 {
-    ash::write_data(stream, tx.txOutPt());
-    ash::db::write_data(stream, tx.signature());
+    return encoded_size(txin.txOutPt()) + db::encoded_size(txin.signature());
 }
 
-void write_data(std::ostream& stream, const TxOut& tx)
+std::size_t encoded_size(const TxOut& txout)
 {
-    ash::db::write_data(stream, tx.address());
-    ash::db::write_data(stream, tx.amount());
+    return db::encoded_size(txout.address()) + sizeof(double);
 }
 
-void write_data(std::ostream& stream, const Transaction& tx)
+std::size_t encoded_size(const Transaction& tx)
 {
-    ash::db::write_data(stream, tx.id());
-    
+    auto size = db::encoded_size(tx.id()) + 2 * sizeof(db::StrLenType);
+    for (const auto& txin : tx.txIns())
     {
-        const auto txins = tx.txIns();
-        auto txinsize = static_cast<ash::db::StrLenType>(txins.size());
-        ash::db::write_data<ash::db::StrLenType>(stream, txinsize);
-        for (const auto& txin : txins)
-        {
-            write_data(stream, txin);
-        }
+        size += encoded_size(txin);
     }
 
+    for (const auto& txout : tx.txOuts())
     {
-        const auto txouts = tx.txOuts();
-        auto txoutsize = static_cast<ash::db::StrLenType>(txouts.size());
-        ash::db::write_data<ash::db::StrLenType>(stream, txoutsize);
-        for (const auto& txout : txouts)
-        {
-            write_data(stream, txout);
-        }
+        size += encoded_size(txout);
     }
+
+    return size;
 }
 
-void write_block(std::ostream& stream, const Block& block)
+// the size of the record `write_block()` writes for `block`
+std::size_t encoded_size(const Block& block)
+{
+    auto size = sizeof(std::uint32_t)       // version
+        + 3 * sizeof(std::uint64_t)         // index, nonce, difficulty
+        + db::encoded_size(block._hashed._data)
+        + sizeof(std::uint64_t)             // time
+        + db::encoded_size(block._hash)
+        + db::encoded_size(block._hashed._prev)
+        + db::encoded_size(block._miner);
+
+    if (!block._hasTransactions)
+    {
+        return size + db::encoded_size(block.txDigest());
+    }
+
+    size += sizeof(db::StrLenType);
+    for (const auto& tx : block._hashed._txs)
+    {
+        size += encoded_size(tx);
+    }
+
+    return size;
+}
+
+void write_data(db::MemoryWriter& writer, const TxOutPoint& pt)
+{
+    ash::db::write_data(writer, pt.blockIndex);
+    ash::db::write_data(writer, pt.txIndex);
+    ash::db::write_data(writer, pt.txOutIndex);
+}
+
+void write_data(db::MemoryWriter& writer, const TxIn& tx)
+{
+    ash::write_data(writer, tx.txOutPt());
+    ash::db::write_data(writer, tx.signature());
+}
+
+void write_data(db::MemoryWriter& writer, const TxOut& tx)
+{
+    ash::db::write_data(writer, tx.address());
+    ash::db::write_data(writer, tx.amount());
+}
+
+void write_data(db::MemoryWriter& writer, const Transaction& tx)
+{
+    ash::db::write_data(writer, tx.id());
+
+    const auto& txins = tx.txIns();
+    ash::db::write_data(writer, static_cast<ash::db::StrLenType>(txins.size()));
+    for (const auto& txin : txins)
+    {
+        write_data(writer, txin);
+    }
+
+    const auto& txouts = tx.txOuts();
+    ash::db::write_data(writer, static_cast<ash::db::StrLenType>(txouts.size()));
+    for (const auto& txout : txouts)
+    {
+        write_data(writer, txout);
+    }
+}
+
+void write_block(db::MemoryWriter& writer, const Block& block)
 {
-    ash::db::write_data<std::uint64_t>(stream, block.index());
-    ash::db::write_data<std::uint64_t>(stream, block.nonce());
-    ash::db::write_data<std::uint64_t>(stream, block.difficulty());
-    ash::db::write_data(stream, block.data());
+    auto version = static_cast<std::uint32_t>(block._version);
+    if (!block._hasTransactions)
+    {
+        version |= PrunedBlockFlag;
+    }
+
+    ash::db::write_data<std::uint32_t>(writer, version);
+    ash::db::write_data<std::uint64_t>(writer, block._hashed._index);
+    ash::db::write_data<std::uint64_t>(writer, block._hashed._nonce);
+    ash::db::write_data<std::uint64_t>(writer, block._hashed._difficulty);
+    ash::db::write_data(writer, block._hashed._data);
 
     std::uint64_t dtime = 
-        static_cast<std::uint64_t>(block.time().time_since_epoch().count());
-    ash::db::write_data<std::uint64_t>(stream, dtime);
+        static_cast<std::uint64_t>(block._hashed._time.time_since_epoch().count());
+    ash::db::write_data<std::uint64_t>(writer, dtime);
 
-    ash::db::write_data(stream, block.hash());
-    ash::db::write_data(stream, block.previousHash());
-    ash::db::write_data(stream, block.miner());
+    ash::db::write_data(writer, block._hash);
+    ash::db::write_data(writer, block._hashed._prev);
+    ash::db::write_data(writer, block._miner);
 
-    const auto& txs = block.transactions();
-    auto txsize = static_cast<ash::db::StrLenType>(txs.size());
-    ash::db::write_data<ash::db::StrLenType>(stream, txsize);
+    if (!block._hasTransactions)
+    {
+        ash::db::write_data(writer, block.txDigest());
+        return;
+    }
 
+    const auto& txs = block._hashed._txs;
+    ash::db::write_data(writer, static_cast<ash::db::StrLenType>(txs.size()));
     for (const auto& tx : txs)
     {
-        write_data(stream, tx);
+        write_data(writer, tx);
     }
 }
 
-void read_data(std::istream& stream, TxOutPoint& pt)
+void write_block(std::ostream& stream, const Block& block)
+{
+    db::MemoryWriter writer;
+    writer.reserve(encoded_size(block));
+    write_block(writer, block);
+    stream.write(writer.data(), writer.size());
+}
+
+void read_data(db::MemoryReader& stream, TxOutPoint& pt)
 {
     ash::db::read_data(stream, pt.blockIndex);
     ash::db::read_data(stream, pt.txIndex);
     ash::db::read_data(stream, pt.txOutIndex);
 }
 
-void read_data(std::istream& stream, TxIn& txin)
+void read_data(db::MemoryReader& stream, TxIn& txin)
 {
     ash::read_data(stream, txin.txOutPt());
     ash::db::read_data(stream, txin._signature);
 }
 
-void read_data(std::istream& stream, TxOut& txout)
+void read_data(db::MemoryReader& stream, TxOut& txout)
 {
     ash::db::read_data(stream, txout._address);
     ash::db::read_data(stream, txout._amount);
 }
 
-void read_data(std::istream& stream, Transaction& tx)
+void read_data(db::MemoryReader& stream, Transaction& tx)
 {
     ash::db::read_data(stream, tx._id);
 
     {
-        ash::db::StrLenType txincount;
+        ash::db::StrLenType txincount = 0;
         ash::db::read_data(stream, txincount);
+        // a corrupt count cannot reserve more than the bytes left
         auto& txins = tx.txIns();
-        for (ash::db::StrLenType x = 0; x < txincount; x++)
+        txins.reserve(std::min<std::size_t>(txincount, stream.remaining()));
+        for (ash::db::StrLenType x = 0; x < txincount && stream; x++)
         {
             TxIn txin;
             read_data(stream, txin);
-            txins.push_back(txin);
+            txins.push_back(std::move(txin));
         }
     }
 
     {
-        ash::db::StrLenType txoutcount;
+        ash::db::StrLenType txoutcount = 0;
         ash::db::read_data(stream, txoutcount);
         auto& txouts = tx.txOuts();
-        for (ash::db::StrLenType x = 0; x < txoutcount; x++)
+        txouts.reserve(std::min<std::size_t>(txoutcount, stream.remaining()));
+        for (ash::db::StrLenType x = 0; x < txoutcount && stream; x++)
         {
             TxOut txout;
             read_data(stream, txout);
-            txouts.push_back(txout);
+            txouts.push_back(std::move(txout));
         }
     }
 }
 
-void read_block(std::istream& stream, Block& block)
+void read_block(db::MemoryReader& stream, Block& block, std::uint32_t format)
 {
+    bool pruned = false;
+    if (format == LegacyDatabaseFormat)
+    {
+        // every block of a legacy database was hashed with the TEXT rules
+        block._version = HashVersion::TEXT;
+    }
+    else
+    {
+        std::uint32_t version = 0;
+        ash::db::read_data(stream, version);
+        if (!stream)
+        {
+            return;
+        }
+
+        pruned = (version & PrunedBlockFlag) != 0;
+        version &= ~PrunedBlockFlag;
+        if (version < static_cast<std::uint32_t>(HashVersion::TEXT)
+            || version > static_cast<std::uint32_t>(CURRENT_HASH_VERSION))
+        {
+            throw std::logic_error(fmt::format("unsupported block version {}", version));
+        }
+
+        block._version = static_cast<HashVersion>(version);
+    }
+
     ash::db::read_data(stream, block._hashed._index);
     ash::db::read_data(stream, block._hashed._nonce);
     ash::db::read_data(stream, block._hashed._difficulty);
     ash::db::read_data(stream, block._hashed._data);
 
-    std::uint64_t dtime;
+    std::uint64_t dtime = 0;
     ash::db::read_data(stream, dtime);
     block._hashed._time = 
         BlockTime{std::chrono::milliseconds{dtime}};
@@ -138,101 +314,2038 @@ void read_block(std::istream& stream, Block& block)
     ash::db::read_data(stream, block._hashed._prev);
     ash::db::read_data(stream, block._miner);
 
+    if (pruned)
+    {
+        block._hashed._txs.clear();
+        ash::db::read_data(stream, block._txDigest);
+        block._hasTransactions = false;
+        if (block._version == HashVersion::MERKLE)
+        {
+            block._merkleRoot = block._txDigest;
+        }
+
+        return;
+    }
+
     auto& txs = block.transactions();
     auto txcount = static_cast<ash::db::StrLenType>(txs.size());
     ash::db::read_data(stream, txcount);
+    txs.reserve(std::min<std::size_t>(txcount, stream.remaining()));
 
-    for (ash::db::StrLenType x = 0; x < txcount; x++)
+    for (ash::db::StrLenType x = 0; x < txcount && stream; x++)
     {
         Transaction tx;
         read_data(stream, tx);
-        txs.push_back(tx);
+        txs.push_back(std::move(tx));
     }
 }
 
-constexpr std::string_view DatabaseFile = "chain.ashdb";
+// the size of the record `write_record()` writes for `block`
+std::size_t record_size(const Block& block)
+{
+    return sizeof(std::uint32_t) + encoded_size(block) + sizeof(std::uint32_t);
+}
 
-ChainDatabase::ChainDatabase(std::string_view folder)
-    : _folder{ folder },
-      _path{ boost::filesystem::path { _folder.data()} },
-      _dbfile { _path / DatabaseFile.data()},
-      _logger(ash::initializeLogger("ChainDatabase"))
+// writes the block framed by its length and its CRC32C
+void write_record(db::MemoryWriter& writer, const Block& block)
 {
+    const auto size = encoded_size(block);
+    ash::db::write_data(writer, static_cast<std::uint32_t>(size));
+
+    const auto start = writer.size();
+    write_block(writer, block);
+    ash::db::write_data(writer, crypto::CRC32C({ writer.data() + start, size }));
 }
 
-ChainDatabase::~ChainDatabase()
+// reads a record of the `format` database file, a record that is cut
+// short or fails its CRC32C fails the reader
+void read_record(db::MemoryReader& stream, Block& block, std::uint32_t format)
 {
-    if (_txIndex)
+    if (format < DatabaseFormat)
     {
-        delete _txIndex;
+        read_block(stream, block, format);
+        return;
+    }
+
+    std::uint32_t size = 0;
+    ash::db::read_data(stream, size);
+    const auto payload = stream.view(size);
+
+    std::uint32_t crc = 0;
+    ash::db::read_data(stream, crc);
+    if (!stream)
+    {
+        return;
+    }
+    else if (crypto::CRC32C(payload) != crc)
+    {
+        stream.invalidate();
+        return;
+    }
+
+    db::MemoryReader reader{ payload.data(), payload.size() };
+    read_block(reader, block, VersionedDatabaseFormat);
+    if (!reader || !reader.eof())
+    {
+        stream.invalidate();
     }
 }
 
-void ChainDatabase::initialize(Blockchain& blockchain, GenesisCallback gcb)
+namespace db
 {
-    if (!boost::filesystem::exists(_path))
+
+//! A read only mapping of a whole file
+class MappedFile final
+{
+    boost::interprocess::file_mapping   _file;
+    boost::interprocess::mapped_region  _region;
+
+public:
+    explicit MappedFile(const boost::filesystem::path& path)
+        : _file{ path.string().c_str(), boost::interprocess::read_only },
+          _region{ _file, boost::interprocess::read_only }
     {
-        _logger->debug("creating chain database folder {}", _path.generic_string());
-        boost::filesystem::create_directories(_path);
     }
 
-    if (!boost::filesystem::exists(_dbfile))
+    const char* data() const noexcept { return static_cast<const char*>(_region.get_address()); }
+    std::size_t size() const noexcept { return _region.get_size(); }
+};
+
+} // namespace db
+
+namespace
+{
+
+constexpr std::string_view TxIndexFolder = "txinindx";
+
+// the number of blocks in the txid index, the key cannot clash with
+// the hex txids
+constexpr std::string_view TxIndexHeightKey = "!height";
+
+// the txid index entries of many blocks are written in one batch, which
+// is written once it grows past this size
+constexpr std::size_t TxIndexBatchSize = 4u * 1024u * 1024u;
+
+// blocks are decoded in batches of LoadBatchSize and at most
+// LoadQueueDepth decoded batches wait to be checked, and each thread
+// checks the hashes of at least LoadHashGrain blocks
+constexpr std::size_t LoadBatchSize = 256;
+constexpr std::size_t LoadQueueDepth = 4;
+constexpr std::size_t LoadHashGrain = 8;
+
+// the number of segments decoded at the same time while loading
+constexpr std::size_t LoadSegmentCount = 4;
+
+// the new segment files of a replaced chain are written next to the 
+// current ones with this suffix
+constexpr std::string_view TempSuffix = ".tmp";
+
+struct LoadedBlock
+{
+    db::BlockLocation   location;
+    Block               block;
+};
+
+using LoadedBlocks = std::vector<LoadedBlock>;
+
+//! Decodes the records of a segment file on its own thread and hands
+//  them out in batches, so decoding overlaps with checking the blocks
+//  and adding them to the chain
+class BlockDecoder final
+{
+    db::MemoryReader            _reader;
+    std::uint32_t               _segment;
+    std::uint32_t               _format;
+    std::optional<std::uint64_t>    _savedOffset;   // the offset of the segment's last record in the saved index
+
+    std::mutex                  _mutex;
+    std::condition_variable     _ready;     // a batch was queued or decoding ended
+    std::condition_variable     _space;     // a batch was taken or decoding was stopped
+    std::deque<LoadedBlocks>    _batches;
+    std::exception_ptr          _error;
+    std::optional<std::uint64_t>    _tornAt;    // the offset of the first record that could not be read
+    bool                        _done = false;
+    bool                        _stop = false;
+
+    std::thread                 _thread;
+
+    LoadedBlocks decodeBatch()
     {
-        _logger->warn("creating genesis block, starting new chain");
-        assert(gcb);
-        write(gcb());
+        LoadedBlocks batch;
+        while (batch.size() < LoadBatchSize && !_reader.eof())
+        {
+            const auto offset = static_cast<std::uint64_t>(_reader.position());
+
+            // a record that cannot be read may be a torn tail, which
+            // the loader decides, any other record is corrupt
+            const auto start = _reader;
+            Block block;
+            read_record(_reader, block, _format);
+            if (!_reader && !tornTail(start))
+            {
+                throw std::logic_error(fmt::format("could not read the block at offset {} of segment {}", 
+                    offset, _segment));
+            }
+            else if (!_reader)
+            {
+                _tornAt = offset;
+                break;
+            }
+
+            const auto length = static_cast<std::uint64_t>(_reader.position()) - offset;
+            db::BlockLocation location{ _segment, offset, static_cast<std::uint32_t>(length), block.hash() };
+            batch.push_back(LoadedBlock{ std::move(location), std::move(block) });
+        }
+
+        return batch;
     }
 
-    _logger->info("loading blockchain from {}", _dbfile.string());
+    // true when the record at `record` can have been cut short by a 
+    // crash, which is when it runs to the end of the file and the saved
+    // index, written after the records, does not have it. A corrupt 
+    // length also takes the reader to the end of the file, so it is 
+    // the length the record claims that is checked.
+    bool tornTail(db::MemoryReader record) const
+    {
+        const auto offset = static_cast<std::uint64_t>(record.position());
+        if (_savedOffset.has_value() && *_savedOffset >= offset)
+        {
+            return false;
+        }
+
+        if (_format < DatabaseFormat)
+        {
+            return _reader.eof();
+        }
+
+        const auto fileSize = offset + record.remaining();
+        std::uint32_t size = 0;
+        ash::db::read_data(record, size);
+        return !record 
+            || offset + sizeof(std::uint32_t) + size + sizeof(std::uint32_t) >= fileSize;
+    }
 
-    std::ifstream ifs(_dbfile.c_str(), std::ios_base::binary);
-    while (ifs.peek() != EOF)
+    void run()
     {
-        Block block;
-        read_block(ifs, block);
-        blockchain._blocks.push_back(block);
+        try
+        {
+            while (true)
+            {
+                auto batch = decodeBatch();
+
+                std::unique_lock<std::mutex> lock{_mutex};
+                _space.wait(lock, [this]() { return _stop || _batches.size() < LoadQueueDepth; });
+                if (_stop)
+                {
+                    return;
+                }
+
+                if (!batch.empty())
+                {
+                    _batches.push_back(std::move(batch));
+                }
+
+                _done = _reader.eof() || _tornAt.has_value();
+                _ready.notify_all();
+                if (_done)
+                {
+                    return;
+                }
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _error = std::current_exception();
+            _done = true;
+            _ready.notify_all();
+        }
     }
 
-    if (!blockchain.isValidChain())
+public:
+    BlockDecoder(db::MemoryReader reader, std::uint32_t segment, std::uint32_t format,
+            std::optional<std::uint64_t> savedOffset)
+        : _reader{ reader },
+          _segment{ segment },
+          _format{ format },
+          _savedOffset{ savedOffset },
+          _thread{ &BlockDecoder::run, this }
     {
-        throw std::logic_error("invalid chain");
     }
 
-    boost::filesystem::path txidx { _path / "txinindx" };
-    leveldb::Options options;
-    options.create_if_missing = true;
-    leveldb::Status status = leveldb::DB::Open(options, txidx.string(), &_txIndex);
-    if (!status.ok())
+    ~BlockDecoder()
     {
-        throw std::logic_error(fmt::format("could not open txin index: {}", status.ToString()));
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            _stop = true;
+        }
+
+        _space.notify_all();
+        _thread.join();
     }
 
-    _logger->info("loaded {} blocks from saved chain", blockchain.size());
+    std::uint32_t segment() const noexcept { return _segment; }
+
+    // the offset of the first record that could not be read, once
+    // `next()` has returned every batch
+    std::optional<std::uint64_t> tornAt()
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        return _tornAt;
+    }
+
+    // the next batch in file order, which is empty once every record 
+    // is decoded, a decoding error is thrown after the batches before it
+    LoadedBlocks next()
+    {
+        std::unique_lock<std::mutex> lock{_mutex};
+        _ready.wait(lock, [this]() { return !_batches.empty() || _done; });
+
+        if (!_batches.empty())
+        {
+            auto batch = std::move(_batches.front());
+            _batches.pop_front();
+            _space.notify_all();
+            return batch;
+        }
+
+        if (_error)
+        {
+            std::rethrow_exception(_error);
+        }
+
+        return {};
+    }
+};
+
+std::string EncodeTxPoint(std::uint64_t blockIndex, std::uint64_t txIndex)
+{
+    std::ostringstream stream;
+    ash::db::write_data(stream, blockIndex);
+    ash::db::write_data(stream, txIndex);
+    return stream.str();
 }
 
-void ChainDatabase::write(const Block& block)
+// opens the database file for appending and writes the header
+// when the file is new, `tellp()` is the offset of the next record
+std::ofstream OpenForAppend(const boost::filesystem::path& dbfile)
 {
-    std::ofstream ofs(_dbfile.c_str(), std::ios::app | std::ios::out | std::ios::binary);
-    write_block(ofs, block);
+    const bool newfile = !boost::filesystem::exists(dbfile) 
+        || boost::filesystem::file_size(dbfile) == 0;
+
+    std::ofstream ofs(dbfile.c_str(), std::ios::app | std::ios::out | std::ios::binary);
+    if (newfile)
+    {
+        write_header(ofs);
+    }
+
+    ofs.seekp(0, std::ios::end);
+    return ofs;
 }
 
-void ChainDatabase::writeChain(const Blockchain& chain)
+// the name of a segment file, the first segment keeps the name of the
+// database file from before segments
+std::string SegmentFileName(std::size_t segment)
 {
-    _logger->debug("writing {} blocks to file {}", chain.size(), _dbfile.string());
-    std::ofstream ofs(_dbfile.c_str(), std::ios::app | std::ios::out | std::ios::binary);
-    for (const auto& block : chain)
+    if (segment == 0)
     {
-        write_block(ofs, block);
+        return std::string{ DatabaseFile };
     }
+
+    return fmt::format("chain.{:05}.ashdb", segment);
 }
 
-void ChainDatabase::reset()
+//! Appends block records to the segment files in a folder. A new 
+//  segment is started when a record would take the current segment 
+//  past the maximum size, so a record larger than that gets a segment
+//  of its own.
+class SegmentAppender final
+{
+    boost::filesystem::path     _folder;
+    std::string                 _suffix;
+    std::uint64_t               _maxSize;
+    std::uint32_t               _segment;
+    std::uint32_t               _unsynced;  // the first segment written since the last sync
+    std::ofstream               _ofs;
+    db::MemoryWriter            _record;
+
+public:
+    // appends to the last of `segmentCount` segments
+    SegmentAppender(boost::filesystem::path folder, std::size_t segmentCount, 
+            std::uint64_t maxSize, std::string_view suffix = {})
+        : _folder{ std::move(folder) },
+          _suffix{ suffix },
+          _maxSize{ maxSize },
+          _segment{ static_cast<std::uint32_t>(segmentCount > 0 ? segmentCount - 1 : 0) },
+          _unsynced{ _segment },
+          _ofs{ OpenForAppend(path(_segment)) }
+    {
+    }
+
+    boost::filesystem::path path(std::uint32_t segment) const
+    {
+        return _folder / (SegmentFileName(segment) + _suffix);
+    }
+
+    // the last segment that was written to
+    std::uint32_t segment() const noexcept { return _segment; }
+
+    db::BlockLocation append(const Block& block)
+    {
+        // the buffer is kept between records so it rarely grows
+        _record.clear();
+        _record.reserve(record_size(block));
+        write_record(_record, block);
+
+        auto offset = static_cast<std::uint64_t>(_ofs.tellp());
+        if (offset > DatabaseHeaderSize && offset + _record.size() > _maxSize)
+        {
+            _ofs.close();
+            _segment++;
+
+            // a file past the last segment was left behind and is stale
+            const auto next = path(_segment);
+            if (boost::filesystem::exists(next))
+            {
+                boost::filesystem::remove(next);
+            }
+
+            _ofs = OpenForAppend(next);
+            offset = static_cast<std::uint64_t>(_ofs.tellp());
+        }
+
+        // a short write leaves the stream failed, the record must not
+        // be handed out as if it were in the segment
+        _ofs.write(_record.data(), _record.size());
+        if (!_ofs)
+        {
+            throw std::logic_error(fmt::format("could not append block #{} to {}", 
+                block.index(), path(_segment).string()));
+        }
+
+        return db::BlockLocation{ _segment, offset, static_cast<std::uint32_t>(_record.size()), block.hash() };
+    }
+
+    void flush()
+    {
+        _ofs.flush();
+        if (!_ofs)
+        {
+            throw std::logic_error(fmt::format("could not flush {}", path(_segment).string()));
+        }
+    }
+
+    // flushes the records and syncs the segments written since the 
+    // last sync to disk
+    void sync()
+    {
+        flush();
+        for (auto segment = _unsynced; segment <= _segment; segment++)
+        {
+            utils::syncFile(path(segment).string());
+        }
+
+        _unsynced = _segment;
+    }
+};
+
+// the manifest is replaced in one rename so it always lists a whole
+// set of segments
+void WriteManifest(const boost::filesystem::path& manifestfile, const std::vector<std::string>& segments)
+{
+    const boost::filesystem::path tempfile{ manifestfile.string() + TempSuffix.data() };
+
+    {
+        std::ofstream ofs(tempfile.c_str(), std::ios::trunc | std::ios::out | std::ios::binary);
+        ofs.write(ManifestMagic.data(), ManifestMagic.size());
+        ash::db::write_data<std::uint32_t>(ofs, ManifestFormat);
+        for (const auto& segment : segments)
+        {
+            ash::db::write_data(ofs, segment);
+        }
+    }
+
+    boost::filesystem::rename(tempfile, manifestfile);
+}
+
+// returns the names of the segment files or nothing when the manifest
+// is missing or cannot be read
+std::optional<std::vector<std::string>> ReadManifest(const boost::filesystem::path& manifestfile)
 {
-    _logger->debug("deleting datbase file {}", _dbfile.string());
+    std::ifstream ifs(manifestfile.c_str(), std::ios_base::binary);
+    if (!ifs)
+    {
+        return {};
+    }
+
+    std::string magic(ManifestMagic.size(), '\0');
+    ifs.read(magic.data(), magic.size());
+
+    std::uint32_t format = 0;
+    ash::db::read_data(ifs, format);
+    if (!ifs || magic != ManifestMagic || format != ManifestFormat)
+    {
+        return {};
+    }
+
+    std::vector<std::string> segments;
+    while (ifs.peek() != EOF)
+    {
+        std::string segment;
+        ash::db::read_data(ifs, segment);
+        if (!ifs)
+        {
+            return {};
+        }
+
+        segments.push_back(std::move(segment));
+    }
+
+    return segments;
+}
+
+void WriteLocations(std::ostream& stream, const std::vector<db::BlockLocation>& locations)
+{
+    for (const auto& location : locations)
+    {
+        ash::db::write_data(stream, location.segment);
+        ash::db::write_data(stream, location.offset);
+        ash::db::write_data(stream, location.length);
+        ash::db::write_data(stream, location.hash);
+    }
+}
+
+void WriteIndexFile(const boost::filesystem::path& indexfile, const std::vector<db::BlockLocation>& locations)
+{
+    std::ofstream ofs(indexfile.c_str(), std::ios::trunc | std::ios::out | std::ios::binary);
+    ofs.write(IndexMagic.data(), IndexMagic.size());
+    ash::db::write_data<std::uint32_t>(ofs, IndexFormat);
+    WriteLocations(ofs, locations);
+}
+
+// returns the saved locations or nothing when the file is missing
+// or cannot be read
+std::optional<std::vector<db::BlockLocation>> ReadIndexFile(const boost::filesystem::path& indexfile)
+{
+    std::ifstream ifs(indexfile.c_str(), std::ios_base::binary);
+    if (!ifs)
+    {
+        return {};
+    }
+
+    std::string magic(IndexMagic.size(), '\0');
+    ifs.read(magic.data(), magic.size());
 
-    if (boost::filesystem::exists(_dbfile))
+    std::uint32_t format = 0;
+    ash::db::read_data(ifs, format);
+    if (!ifs || magic != IndexMagic || format != IndexFormat)
+    {
+        return {};
+    }
+
+    std::vector<db::BlockLocation> locations;
+    while (ifs.peek() != EOF)
     {
-        boost::filesystem::remove(_dbfile);
+        db::BlockLocation location;
+        ash::db::read_data(ifs, location.segment);
+        ash::db::read_data(ifs, location.offset);
+        ash::db::read_data(ifs, location.length);
+        ash::db::read_data(ifs, location.hash);
+        if (!ifs)
+        {
+            return {};
+        }
+
+        locations.push_back(std::move(location));
+    }
+
+    return locations;
+}
+
+std::string SnapshotFileName(std::uint64_t height)
+{
+    return fmt::format("{}{:010}{}", SnapshotPrefix, height, SnapshotSuffix);
+}
+
+// the heights of the snapshots in `folder`, newest first
+std::vector<std::uint64_t> FindSnapshots(const boost::filesystem::path& folder)
+{
+    std::vector<std::uint64_t> heights;
+    if (!boost::filesystem::is_directory(folder))
+    {
+        return heights;
+    }
+
+    for (const auto& entry : boost::filesystem::directory_iterator{ folder })
+    {
+        const auto name = entry.path().filename().string();
+        if (name.size() <= SnapshotPrefix.size() + SnapshotSuffix.size()
+            || !boost::starts_with(name, SnapshotPrefix)
+            || !boost::ends_with(name, SnapshotSuffix))
+        {
+            continue;
+        }
+
+        const auto digits = name.substr(SnapshotPrefix.size(), 
+            name.size() - SnapshotPrefix.size() - SnapshotSuffix.size());
+        if (std::all_of(digits.begin(), digits.end(), [](char c) { return c >= '0' && c <= '9'; }))
+        {
+            heights.push_back(std::stoull(digits));
+        }
+    }
+
+    std::sort(heights.begin(), heights.end(), std::greater<>{});
+    return heights;
+}
+
+// the size of the index file up to the location at `count`
+std::uint64_t IndexFileSize(const std::vector<db::BlockLocation>& locations, std::size_t count)
+{
+    std::uint64_t size = IndexMagic.size() + sizeof(std::uint32_t);
+    for (std::size_t idx = 0; idx < count; idx++)
+    {
+        size += sizeof(std::uint32_t) + sizeof(std::uint64_t) + sizeof(std::uint32_t) 
+            + sizeof(db::StrLenType) + locations[idx].hash.size();
+    }
+
+    return size;
+}
+
+} // namespace
+
+ChainDatabase::ChainDatabase(std::string_view folder, std::uint64_t maxFileSize, db::SyncMode syncMode)
+    : _folder{ folder },
+      _path{ boost::filesystem::path { _folder.data()} },
+      _dbfile { _path / DatabaseFile.data()},
+      _indexfile { _path / IndexFile.data()},
+      _manifestfile { _path / ManifestFile.data()},
+      _maxFileSize { maxFileSize },
+      _format { DatabaseFormat },
+      _syncMode { syncMode },
+      _logger(ash::initializeLogger("ChainDatabase"))
+{
+    _writeThread = std::thread(&ChainDatabase::runWriter, this);
+}
+
+ChainDatabase::~ChainDatabase()
+{
+    // the queued blocks are appended before the thread stops
+    {
+        std::lock_guard<std::mutex> lock{_pendingMutex};
+        _stopWriting = true;
+    }
+
+    _pendingReady.notify_all();
+    _writeThread.join();
+
+    _stopIndexing = true;
+    if (_txIndexThread.joinable())
+    {
+        _txIndexThread.join();
+    }
+
+    if (_txIndex)
+    {
+        delete _txIndex;
+    }
+}
+
+void ChainDatabase::initialize(Blockchain& blockchain, GenesisCallback gcb)
+{
+    if (!boost::filesystem::exists(_path))
+    {
+        _logger->debug("creating chain database folder {}", _path.generic_string());
+        boost::filesystem::create_directories(_path);
+    }
+
+    boost::filesystem::path txidx { _path / TxIndexFolder.data() };
+    leveldb::Options options;
+    options.create_if_missing = true;
+    options.write_buffer_size = _txIndexOptions.writeBufferSize;
+
+    _txIndexCache.reset(leveldb::NewLRUCache(_txIndexOptions.cacheSize));
+    options.block_cache = _txIndexCache.get();
+
+    if (_txIndexOptions.bloomBits > 0)
+    {
+        _txIndexFilter.reset(leveldb::NewBloomFilterPolicy(static_cast<int>(_txIndexOptions.bloomBits)));
+        options.filter_policy = _txIndexFilter.get();
+    }
+
+    leveldb::Status status = leveldb::DB::Open(options, txidx.string(), &_txIndex);
+    if (!status.ok())
+    {
+        throw std::logic_error(fmt::format("could not open txin index: {}", status.ToString()));
+    }
+
+    auto segments = ReadManifest(_manifestfile);
+    if (!segments.has_value() && boost::filesystem::exists(_dbfile))
+    {
+        // a database from before segments is a single file
+        segments = std::vector<std::string>{ std::string{ DatabaseFile } };
+        WriteManifest(_manifestfile, *segments);
+    }
+    else if (!segments.has_value())
+    {
+        _logger->warn("creating genesis block, starting new chain");
+        assert(gcb);
+
+        // the txid index of a new chain is complete from the first block
+        _txIndexReady = true;
+        write(gcb());
+        flush();
+
+        std::lock_guard<std::mutex> lock{_locationsMutex};
+        segments = _segments;
+    }
+
+    _logger->info("loading blockchain from {} segment(s) in {}", segments->size(), _path.string());
+
+    std::uint32_t format = DatabaseFormat;
+    const auto savedLocations = ReadIndexFile(_indexfile);
+
+    // the records are decoded straight from the mapped segments
+    std::vector<std::shared_ptr<const db::MappedFile>> mappings;
+    std::vector<db::MemoryReader> readers;
+    bool formatRead = false;
+    for (std::size_t idx = 0; idx < segments->size(); idx++)
+    {
+        const auto segmentfile = _path / segments->at(idx);
+        if (!boost::filesystem::exists(segmentfile))
+        {
+            throw std::logic_error(fmt::format("missing database segment {}", segmentfile.string()));
+        }
+
+        // a new segment whose header was cut short holds no blocks
+        if (idx > 0 && boost::filesystem::file_size(segmentfile) < DatabaseHeaderSize)
+        {
+            boost::filesystem::resize_file(segmentfile, 0);
+        }
+
+        if (boost::filesystem::file_size(segmentfile) == 0)
+        {
+            mappings.emplace_back();
+            readers.emplace_back(nullptr, 0);
+            continue;
+        }
+
+        auto mapping = std::make_shared<const db::MappedFile>(segmentfile);
+        db::MemoryReader reader{ mapping->data(), mapping->size() };
+        const auto segmentFormat = read_header(reader);
+        if (segmentFormat == LegacyDatabaseFormat && segments->size() > 1)
+        {
+            throw std::logic_error(fmt::format("legacy database segment {}", segmentfile.string()));
+        }
+        else if (formatRead && segmentFormat != format)
+        {
+            throw std::logic_error(fmt::format("database segment {} has format {} instead of {}", 
+                segmentfile.string(), segmentFormat, format));
+        }
+
+        format = segmentFormat;
+        formatRead = true;
+
+        mappings.push_back(std::move(mapping));
+        readers.push_back(reader);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{_locationsMutex};
+        _locations.clear();
+        _segments = *segments;
+        _mappings = std::move(mappings);
+        _format = format;
+    }
+
+    // a few segments are decoded ahead on their own threads, the block
+    // hashes are checked in parallel and the links between the blocks 
+    // are checked in order as the blocks are added to the chain
+    std::vector<std::optional<std::uint64_t>> savedOffsets(readers.size());
+    if (savedLocations.has_value())
+    {
+        for (const auto& location : *savedLocations)
+        {
+            if (location.segment < savedOffsets.size())
+            {
+                auto& saved = savedOffsets[location.segment];
+                saved = std::max(saved.value_or(0), location.offset);
+            }
+        }
+    }
+
+    std::deque<std::unique_ptr<BlockDecoder>> decoders;
+    std::size_t nextSegment = 0;
+    const auto startDecoders = 
+        [&decoders, &nextSegment, &readers, &savedOffsets, format]()
+        {
+            while (nextSegment < readers.size() && decoders.size() < LoadSegmentCount)
+            {
+                decoders.push_back(std::make_unique<BlockDecoder>(readers[nextSegment], 
+                    static_cast<std::uint32_t>(nextSegment), format, savedOffsets[nextSegment]));
+                nextSegment++;
+            }
+        };
+
+    std::optional<std::string> prevHash;
+    std::uint64_t prevIndex = 0;
+    if (blockchain.size() > 0)
+    {
+        prevHash = blockchain.back().hash();
+        prevIndex = blockchain.back().index();
+    }
+
+    // the blocks the newest snapshot covers are only checked and added
+    // to the chain, the state derived from them is restored from the
+    // snapshot and only the blocks after it are replayed
+    std::optional<std::string> snapshotHash;
+    _prunedHeight = 0;
+    if (blockchain.size() == 0 && _snapshotInterval > 0)
+    {
+        snapshotHash = restoreSnapshot(blockchain, savedLocations);
+    }
+
+    std::uint64_t restoredHeight = snapshotHash.has_value() ? _snapshotHeight : 0;
+    const auto dropSnapshot = 
+        [this, &blockchain, &restoredHeight](std::string_view reason)
+        {
+            if (_prunedHeight > 0)
+            {
+                throw std::logic_error(fmt::format("cannot replay the chain state of pruned blocks, {}", reason));
+            }
+
+            _logger->warn("replaying the chain state, {}", reason);
+            boost::filesystem::remove(_path / SnapshotFileName(restoredHeight));
+            blockchain.replayState();
+            restoredHeight = 0;
+            _snapshotHeight = 0;
+        };
+
+    for (startDecoders(); !decoders.empty(); startDecoders())
+    {
+        auto& decoder = *(decoders.front());
+        for (auto batch = decoder.next(); !batch.empty(); batch = decoder.next())
+        {
+            // not a vector<bool> so the threads write separate bytes
+            std::vector<std::uint8_t> validHash(batch.size(), 0);
+            utils::ParallelFor(batch.size(), LoadHashGrain,
+                [&batch, &validHash](std::size_t begin, std::size_t end)
+                {
+                    for (auto idx = begin; idx < end; idx++)
+                    {
+                        const auto& block = batch[idx].block;
+                        validHash[idx] = (CalculateBlockHash(block) == block.hash());
+                    }
+                });
+
+            for (auto idx = 0u; idx < batch.size(); idx++)
+            {
+                auto& [location, block] = batch[idx];
+
+                // like isValidChain() the first block is not checked
+                if (prevHash.has_value()
+                    && (block.index() != prevIndex + 1
+                        || block.previousHash() != *prevHash
+                        || !validHash[idx]))
+                {
+                    throw std::logic_error(fmt::format("invalid chain at block #{}", block.index()));
+                }
+
+                prevHash = location.hash;
+                prevIndex = block.index();
+
+                const auto covered = blockchain.size() < restoredHeight;
+                const auto mismatch = blockchain.size() + 1 == restoredHeight 
+                    && location.hash != *snapshotHash;
+
+                // the state of pruned blocks can only come from a snapshot
+                if (!block.hasTransactions())
+                {
+                    if (!covered)
+                    {
+                        throw std::logic_error(fmt::format("block #{} is pruned and no snapshot covers it", block.index()));
+                    }
+
+                    _prunedHeight = blockchain.size() + 1;
+                }
+
+                // added first so a chain that only keeps headers can 
+                // drop the transactions as soon as the block is indexed
+                addLocation(std::move(location));
+                if (covered)
+                {
+                    blockchain.appendBlock(std::move(block));
+                }
+                else
+                {
+                    blockchain.pushBlock(std::move(block));
+                }
+
+                if (mismatch)
+                {
+                    dropSnapshot("the snapshot was taken at another block");
+                }
+            }
+        }
+
+        // a record cut short by a crash can only be at the end of the 
+        // last segment, which is cut off there so only the blocks after
+        // it have to be fetched from peers again
+        if (const auto tornAt = decoder.tornAt(); tornAt.has_value())
+        {
+            const auto segment = decoder.segment();
+            const auto segmentfile = _path / segments->at(segment);
+            if (segment + 1u != segments->size())
+            {
+                throw std::logic_error(fmt::format("could not read the block at offset {} of {}", 
+                    *tornAt, segmentfile.string()));
+            }
+
+            _logger->warn("cutting off the torn tail of {} at offset {}", segmentfile.string(), *tornAt);
+
+            {
+                std::lock_guard<std::mutex> lock{_locationsMutex};
+                _mappings.at(segment).reset();
+            }
+
+            boost::filesystem::resize_file(segmentfile, *tornAt);
+        }
+
+        decoders.pop_front();
+    }
+
+    if (blockchain.size() < restoredHeight)
+    {
+        dropSnapshot("the chain ends before the snapshot");
+    }
+
+    if (format < DatabaseFormat)
+    {
+        _logger->info("upgrading {} to database format {}", _path.string(), DatabaseFormat);
+        replaceChain(blockchain);
+    }
+    else if (std::lock_guard<std::mutex> lock{_locationsMutex}; 
+        savedLocations != _locations)
+    {
+        _logger->info("rebuilding the block index {}", _indexfile.string());
+        WriteIndexFile(_indexfile, _locations);
+    }
+
+    _blockCount = blockchain.size();
+
+    if (readTxIndexHeight() == blockchain.size())
+    {
+        _txIndexReady = true;
+    }
+    else
+    {
+        // the chain cannot be shared with the thread, so it reads the
+        // blocks back from the database file
+        const std::size_t count = _blockCount;
+
+        _logger->info("rebuilding the txid index of {} blocks", count);
+        _txIndexThread = std::thread(
+            [this, count]()
+            {
+                leveldb::WriteBatch batch;
+                for (std::size_t idx = 0; idx < count; idx++)
+                {
+                    if (_stopIndexing)
+                    {
+                        return;
+                    }
+
+                    std::optional<Block> block;
+                    try
+                    {
+                        block = readBlock(idx);
+                    }
+                    catch (const std::exception& ex)
+                    {
+                        _logger->warn("could not read block #{}: {}", idx, ex.what());
+                    }
+
+                    if (!block.has_value())
+                    {
+                        // the file was rewritten, the next start rebuilds the index
+                        _logger->warn("stopped rebuilding the txid index at block #{}", idx);
+                        return;
+                    }
+
+                    indexBlock(batch, *block);
+                    if (batch.ApproximateSize() >= TxIndexBatchSize)
+                    {
+                        writeTxIndex(batch);
+                    }
+                }
+
+                // blocks written in the meantime were indexed by write()
+                writeTxIndexHeight(batch, _blockCount);
+                writeTxIndex(batch);
+                _txIndexReady = true;
+                _logger->info("finished rebuilding the txid index");
+            });
+    }
+
+    // a chain that was replayed is snapshotted right away
+    _pruningHeight = _prunedHeight.load();
+    checkpoint(blockchain);
+
+    _logger->info("loaded {} blocks from saved chain", blockchain.size());
+}
+
+bool ChainDatabase::hasBlock(std::size_t index, std::string_view hash) const
+{
+    std::lock_guard<std::mutex> lock{_locationsMutex};
+    return index < _locations.size() && _locations[index].hash == hash;
+}
+
+std::optional<Block> ChainDatabase::readBlock(std::size_t index) const
+{
+    std::shared_lock<std::shared_mutex> fileLock{_truncateMutex};
+
+    db::BlockLocation location;
+    std::uint32_t format = DatabaseFormat;
+    std::shared_ptr<const db::MappedFile> mapping;
+
+    {
+        std::lock_guard<std::mutex> lock{_locationsMutex};
+        if (index >= _locations.size())
+        {
+            return {};
+        }
+
+        location = _locations[index];
+        format = _format;
+
+        // blocks appended since the segment was mapped need a new mapping
+        auto& segmentMapping = _mappings.at(location.segment);
+        if (!segmentMapping || location.offset + location.length > segmentMapping->size())
+        {
+            segmentMapping = std::make_shared<const db::MappedFile>(segmentPath(location.segment));
+        }
+
+        mapping = segmentMapping;
+    }
+
+    if (location.offset + location.length > mapping->size())
+    {
+        return {};
+    }
+
+    db::MemoryReader reader{ mapping->data() + location.offset, location.length };
+
+    Block block;
+    read_record(reader, block, format);
+    if (!reader)
+    {
+        return {};
+    }
+
+    return block;
+}
+
+void ChainDatabase::addLocation(db::BlockLocation location)
+{
+    std::lock_guard<std::mutex> lock{_locationsMutex};
+    _locations.push_back(std::move(location));
+}
+
+// extends the manifest to `count` segments when the last blocks were 
+// written past the segments it lists
+void ChainDatabase::addSegments(std::size_t count)
+{
+    std::lock_guard<std::mutex> lock{_locationsMutex};
+    if (count <= _segments.size())
+    {
+        return;
+    }
+
+    while (_segments.size() < count)
+    {
+        _segments.push_back(SegmentFileName(_segments.size()));
+        _mappings.emplace_back();
+    }
+
+    WriteManifest(_manifestfile, _segments);
+}
+
+// the caller holds _locationsMutex
+boost::filesystem::path ChainDatabase::segmentPath(std::size_t segment) const
+{
+    return _path / _segments.at(segment);
+}
+
+std::size_t ChainDatabase::segmentCount() const
+{
+    std::lock_guard<std::mutex> lock{_locationsMutex};
+    return _segments.size();
+}
+
+void ChainDatabase::appendLocations(std::vector<db::BlockLocation> locations)
+{
+    std::lock_guard<std::mutex> lock{_locationsMutex};
+
+    if (_locations.empty())
+    {
+        WriteIndexFile(_indexfile, locations);
+    }
+    else
+    {
+        std::ofstream ofs(_indexfile.c_str(), std::ios::app | std::ios::out | std::ios::binary);
+        WriteLocations(ofs, locations);
+    }
+
+    _locations.insert(_locations.end(), 
+        std::make_move_iterator(locations.begin()), std::make_move_iterator(locations.end()));
+}
+
+std::optional<TxPoint> ChainDatabase::findTransaction(std::string_view txid) const
+{
+    if (!_txIndex)
+    {
+        return {};
+    }
+
+    std::string value;
+    if (!_txIndex->Get(leveldb::ReadOptions{}, leveldb::Slice{ txid.data(), txid.size() }, &value).ok())
+    {
+        return {};
+    }
+
+    std::istringstream stream{ value };
+    std::uint64_t blockIndex = 0;
+    std::uint64_t txIndex = 0;
+    ash::db::read_data(stream, blockIndex);
+    ash::db::read_data(stream, txIndex);
+    if (!stream)
+    {
+        return {};
+    }
+
+    return TxPoint{ blockIndex, txIndex };
+}
+
+void ChainDatabase::indexBlock(leveldb::WriteBatch& batch, const Block& block)
+{
+    const auto& txs = block.transactions();
+    for (auto txidx = 0u; txidx < txs.size(); txidx++)
+    {
+        batch.Put(txs.at(txidx).id(), EncodeTxPoint(block.index(), txidx));
+    }
+}
+
+void ChainDatabase::writeTxIndexHeight(leveldb::WriteBatch& batch, std::uint64_t height)
+{
+    std::ostringstream stream;
+    ash::db::write_data(stream, height);
+    batch.Put(TxIndexHeightKey.data(), stream.str());
+}
+
+// applies the index entries of `batch` in one write and clears it, the
+// index is rebuilt from the blocks so it is not synced
+void ChainDatabase::writeTxIndex(leveldb::WriteBatch& batch)
+{
+    if (_txIndex)
+    {
+        if (const auto status = _txIndex->Write(leveldb::WriteOptions{}, &batch); !status.ok())
+        {
+            _logger->error("could not write to the txid index: {}", status.ToString());
+        }
+    }
+
+    batch.Clear();
+}
+
+std::optional<std::uint64_t> ChainDatabase::readTxIndexHeight() const
+{
+    std::string value;
+    if (!_txIndex->Get(leveldb::ReadOptions{}, TxIndexHeightKey.data(), &value).ok())
+    {
+        return {};
+    }
+
+    std::istringstream stream{ value };
+    std::uint64_t height = 0;
+    ash::db::read_data(stream, height);
+    if (!stream)
+    {
+        return {};
+    }
+
+    return height;
+}
+
+void ChainDatabase::write(const Block& block)
+{
+    std::unique_lock<std::mutex> lock{_pendingMutex};
+    _pendingDone.wait(lock, [this]() { return _writeError || _pending.size() < WriteQueueSize; });
+    if (_writeError)
+    {
+        std::rethrow_exception(_writeError);
+    }
+
+    _pending.push_back(block);
+    _unwritten++;
+    const auto ticket = ++_queued;
+    _pendingReady.notify_one();
+
+    if (_syncMode == db::SyncMode::Full)
+    {
+        _pendingDone.wait(lock, [this, ticket]() { return _writeError || _committed >= ticket; });
+        if (_committed < ticket)
+        {
+            std::rethrow_exception(_writeError);
+        }
+    }
+}
+
+void ChainDatabase::flush()
+{
+    std::unique_lock<std::mutex> lock{_pendingMutex};
+    _pendingDone.wait(lock, [this]() { return writerIdle(); });
+    if (_writeError)
+    {
+        std::rethrow_exception(_writeError);
+    }
+}
+
+// the caller holds _pendingMutex
+bool ChainDatabase::writerIdle() const
+{
+    return _pending.empty() && _writing == 0 && !_checkpoint && !_checkpointing;
+}
+
+// waits for the queued blocks and checkpoint to be written, the returned
+// lock keeps new blocks queued while the caller changes the files, after
+// which the persistence thread reopens the last segment
+std::unique_lock<std::mutex> ChainDatabase::pauseWriter()
+{
+    std::unique_lock<std::mutex> lock{_pendingMutex};
+    _pendingDone.wait(lock, [this]() { return writerIdle(); });
+    _reopenSegment = true;
+    return lock;
+}
+
+// appends the queued blocks in groups, each group is written with one
+// flush and, unless syncing is off, one sync of the segments it wrote.
+// A queued checkpoint is written after the group that was queued with
+// it, so the snapshot never covers blocks that are not in the segments.
+void ChainDatabase::runWriter()
+{
+    std::unique_ptr<SegmentAppender> appender;
+
+    while (true)
+    {
+        std::vector<Block> group;
+        std::optional<Checkpoint> checkpoint;
+        std::exception_ptr error;
+
+        {
+            std::unique_lock<std::mutex> lock{_pendingMutex};
+            _pendingReady.wait(lock, 
+                [this]() { return _stopWriting || !_pending.empty() || _checkpoint; });
+            if (_pending.empty() && !_checkpoint)
+            {
+                return;
+            }
+
+            group.assign(std::make_move_iterator(_pending.begin()), std::make_move_iterator(_pending.end()));
+            _pending.clear();
+            _writing = group.size();
+
+            checkpoint.swap(_checkpoint);
+            _checkpointing = checkpoint.has_value();
+
+            if (_reopenSegment)
+            {
+                appender.reset();
+                _reopenSegment = false;
+            }
+        }
+
+        _pendingDone.notify_all();
+
+        if (!group.empty())
+        {
+            try
+            {
+                if (!appender)
+                {
+                    appender = std::make_unique<SegmentAppender>(_path, segmentCount(), _maxFileSize);
+                }
+
+                std::vector<db::BlockLocation> locations;
+                locations.reserve(group.size());
+                for (const auto& block : group)
+                {
+                    locations.push_back(appender->append(block));
+                }
+
+                if (_syncMode == db::SyncMode::None)
+                {
+                    appender->flush();
+                }
+                else
+                {
+                    appender->sync();
+                }
+
+                addSegments(appender->segment() + 1);
+                appendLocations(std::move(locations));
+
+                // the whole group is indexed in one batch
+                leveldb::WriteBatch batch;
+                for (const auto& block : group)
+                {
+                    indexBlock(batch, block);
+                }
+
+                _blockCount += group.size();
+                if (_txIndexReady)
+                {
+                    writeTxIndexHeight(batch, _blockCount);
+                }
+
+                writeTxIndex(batch);
+            }
+            catch (const std::exception& ex)
+            {
+                // the segment is reopened so the next group starts at its end
+                _logger->error("could not write {} block(s) to {}: {}", group.size(), _path.string(), ex.what());
+                appender.reset();
+                error = std::current_exception();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{_pendingMutex};
+            _unwritten -= group.size();
+            _writing = 0;
+
+            if (error)
+            {
+                // the blocks queued behind the failed group would be
+                // saved at the wrong height, so they fail with it and
+                // nothing is appended until the files are rewritten
+                _unwritten -= _pending.size();
+                _queued -= group.size() + _pending.size();
+                _pending.clear();
+                _writeError = error;
+            }
+            else
+            {
+                _committed += group.size();
+            }
+        }
+
+        _pendingDone.notify_all();
+
+        if (checkpoint && !error)
+        {
+            try
+            {
+                // the snapshot has to reach the disk after its blocks,
+                // which are not synced when syncing is off
+                if (_syncMode == db::SyncMode::None && appender)
+                {
+                    appender->sync();
+                }
+
+                writeCheckpoint(*checkpoint);
+            }
+            catch (const std::exception& ex)
+            {
+                _logger->error("could not write the checkpoint at {} blocks to {}: {}", 
+                    checkpoint->height, _path.string(), ex.what());
+            }
+        }
+
+        if (checkpoint)
+        {
+            {
+                std::lock_guard<std::mutex> lock{_pendingMutex};
+                _checkpointing = false;
+            }
+
+            _pendingDone.notify_all();
+        }
+    }
+}
+
+// writes the snapshot of the checkpoint and prunes the segments, on the
+// persistence thread so the chain is not held up by the disk
+void ChainDatabase::writeCheckpoint(const Checkpoint& checkpoint)
+{
+    // blocks that were rolled back or not appended after the checkpoint
+    // was queued are not covered by it
+    if (_blockCount < checkpoint.height)
+    {
+        _logger->warn("skipping the snapshot at {} blocks, only {} blocks are saved", 
+            checkpoint.height, _blockCount.load());
+        return;
+    }
+
+    saveSnapshot(checkpoint.height, checkpoint.snapshot);
+    if (checkpoint.pruneHeight > 0)
+    {
+        prune(checkpoint.pruneHeight);
+    }
+}
+
+void ChainDatabase::writeChain(const Blockchain& chain)
+{
+    const auto writeLock = pauseWriter();
+    _logger->debug("writing {} blocks to {}", chain.size(), _path.string());
+    std::vector<db::BlockLocation> locations;
+    locations.reserve(chain.size());
+
+    leveldb::WriteBatch batch;
+    SegmentAppender appender{ _path, segmentCount(), _maxFileSize };
+    for (std::size_t idx = 0; idx < chain.size(); idx++)
+    {
+        const auto block = chain.fullBlock(idx);
+        locations.push_back(appender.append(*block));
+        indexBlock(batch, *block);
+        if (batch.ApproximateSize() >= TxIndexBatchSize)
+        {
+            writeTxIndex(batch);
+        }
+    }
+
+    // the blocks can be read back once they are flushed
+    appender.flush();
+    addSegments(appender.segment() + 1);
+    appendLocations(std::move(locations));
+
+    _blockCount += chain.size();
+    if (_txIndexReady)
+    {
+        writeTxIndexHeight(batch, _blockCount);
+    }
+
+    writeTxIndex(batch);
+}
+
+void ChainDatabase::reset()
+{
+    const auto writeLock = pauseWriter();
+    _writeError = nullptr;
+    _logger->debug("deleting database files in {}", _path.string());
+
+    {
+        std::lock_guard<std::mutex> lock{_locationsMutex};
+
+        std::vector<boost::filesystem::path> files{ _dbfile, _manifestfile, _indexfile };
+        for (std::size_t idx = 0; idx < _segments.size(); idx++)
+        {
+            files.push_back(segmentPath(idx));
+        }
+
+        for (const auto& file : files)
+        {
+            if (boost::filesystem::exists(file))
+            {
+                boost::filesystem::remove(file);
+            }
+        }
+
+        _locations.clear();
+        _segments.clear();
+        _mappings.clear();
+        _format = DatabaseFormat;
+    }
+
+    removeSnapshots(0);
+    _prunedHeight = 0;
+    _pruningHeight = 0;
+
+    // the index is complete again once the chain is rewritten, 
+    // until then a restart has to rebuild it
+    _blockCount = 0;
+    if (_txIndex)
+    {
+        _txIndex->Delete(leveldb::WriteOptions{}, TxIndexHeightKey.data());
+    }
+}
+
+void ChainDatabase::replaceChain(const Blockchain& chain)
+{
+    const auto writeLock = pauseWriter();
+    _writeError = nullptr;
+    _logger->debug("replacing the segments in {} with {} blocks", _path.string(), chain.size());
+
+    // a restart has to rebuild the index if this does not finish
+    if (_txIndex)
+    {
+        _txIndex->Delete(leveldb::WriteOptions{}, TxIndexHeightKey.data());
+    }
+
+    std::vector<db::BlockLocation> locations;
+    locations.reserve(chain.size());
+
+    std::vector<std::string> segments;
+    std::uint64_t prunedHeight = 0;
+    leveldb::WriteBatch batch;
+
+    {
+        const auto tempfile = _path / (SegmentFileName(0) + TempSuffix.data());
+        if (boost::filesystem::exists(tempfile))
+        {
+            boost::filesystem::remove(tempfile);
+        }
+
+        SegmentAppender appender{ _path, 0, _maxFileSize, TempSuffix };
+        for (std::size_t idx = 0; idx < chain.size(); idx++)
+        {
+            const auto block = chain.fullBlock(idx);
+            locations.push_back(appender.append(*block));
+            indexBlock(batch, *block);
+            if (batch.ApproximateSize() >= TxIndexBatchSize)
+            {
+                writeTxIndex(batch);
+            }
+
+            if (!block->hasTransactions())
+            {
+                prunedHeight = idx + 1;
+            }
+        }
+
+        for (std::uint32_t idx = 0; idx <= appender.segment(); idx++)
+        {
+            segments.push_back(SegmentFileName(idx));
+        }
+    }
+
+    const boost::filesystem::path tempindex{ _indexfile.string() + TempSuffix.data() };
+    WriteIndexFile(tempindex, locations);
+
+    {
+        // readers keep the old segments mapped until they are done with them
+        std::lock_guard<std::mutex> lock{_locationsMutex};
+        _mappings.clear();
+
+        for (const auto& segment : segments)
+        {
+            boost::filesystem::rename(_path / (segment + TempSuffix.data()), _path / segment);
+        }
+
+        // the segments past the new ones are removed once the manifest
+        // no longer lists them
+        WriteManifest(_manifestfile, segments);
+        for (auto idx = segments.size(); idx < _segments.size(); idx++)
+        {
+            boost::filesystem::remove(segmentPath(idx));
+        }
+
+        boost::filesystem::rename(tempindex, _indexfile);
+        _locations = std::move(locations);
+        _segments = std::move(segments);
+        _mappings.resize(_segments.size());
+        _format = DatabaseFormat;
+    }
+
+    // the snapshots may be of the blocks that were replaced, and the
+    // state of pruned blocks can only be loaded from a snapshot
+    removeSnapshots(0);
+    _prunedHeight = prunedHeight;
+    _pruningHeight = prunedHeight;
+    if (_prunedHeight > 0)
+    {
+        writeSnapshot(chain);
+    }
+
+    _blockCount = chain.size();
+    if (_txIndexReady)
+    {
+        writeTxIndexHeight(batch, _blockCount);
+    }
+
+    writeTxIndex(batch);
+}
+
+void ChainDatabase::truncateTo(std::size_t index)
+{
+    truncate(index, nullptr);
+}
+
+void ChainDatabase::truncateTo(const Blockchain& chain)
+{
+    truncate(chain.size(), &chain);
+}
+
+void ChainDatabase::truncate(std::size_t index, const Blockchain* chain)
+{
+    const auto writeLock = pauseWriter();
+    if (index >= _blockCount)
+    {
+        return;
+    }
+
+    // the state of the pruned blocks that remain is only in the snapshots, 
+    // so one that covers them has to be kept or written before the newer
+    // ones are removed
+    const auto prunedHeight = std::min<std::uint64_t>(_prunedHeight, index);
+    const auto snapshots = FindSnapshots(_path);
+    if (prunedHeight > 0 
+        && std::none_of(snapshots.begin(), snapshots.end(), 
+            [prunedHeight, index](auto height) { return height >= prunedHeight && height <= index; }))
+    {
+        if (!chain)
+        {
+            throw std::logic_error(fmt::format("cannot truncate the database to {} blocks, "
+                "no snapshot would cover the blocks before #{}", index, prunedHeight));
+        }
+
+        assert(chain->size() == index);
+        writeSnapshot(*chain);
+    }
+
+    std::unique_lock<std::shared_mutex> fileLock{_truncateMutex};
+    std::lock_guard<std::mutex> lock{_locationsMutex};
+
+    if (index >= _locations.size())
+    {
+        return;
+    }
+
+    _logger->debug("truncating the database in {} from {} to {} blocks", 
+        _path.string(), _locations.size(), index);
+
+    const auto segment = static_cast<std::size_t>(_locations[index].segment);
+    boost::filesystem::resize_file(segmentPath(segment), _locations[index].offset);
+
+    // the segments after the truncated one are removed once the 
+    // manifest no longer lists them
+    if (_segments.size() > segment + 1)
+    {
+        std::vector<std::string> removed{ _segments.begin() + segment + 1, _segments.end() };
+        _segments.resize(segment + 1);
+        WriteManifest(_manifestfile, _segments);
+
+        for (const auto& name : removed)
+        {
+            boost::filesystem::remove(_path / name);
+        }
+    }
+
+    // the txid index keeps the entries of the removed blocks, which 
+    // lookups already have to check against the chain
+    boost::filesystem::resize_file(_indexfile, IndexFileSize(_locations, index));
+    _locations.resize(index);
+
+    _mappings.resize(_segments.size());
+    _mappings.back().reset();
+
+    removeSnapshots(index);
+    _prunedHeight = prunedHeight;
+
+    // the blocks after `index` are gone along with what a failed group
+    // left, so the blocks that follow are appended at the right height
+    _writeError = nullptr;
+    _pruningHeight = std::min<std::uint64_t>(_pruningHeight, index);
+
+    _blockCount = index;
+    if (_txIndexReady)
+    {
+        leveldb::WriteBatch batch;
+        writeTxIndexHeight(batch, _blockCount);
+        writeTxIndex(batch);
+    }
+}
+
+void ChainDatabase::checkpoint(Blockchain& chain)
+{
+    // the blocks the persistence thread pruned can no longer be rolled back
+    if (_prunedHeight > 0)
+    {
+        chain.pruneState(_prunedHeight);
+    }
+
+    if (_snapshotInterval == 0 
+        || chain.size() == 0
+        || chain.size() < _snapshotHeight + _snapshotInterval)
+    {
+        return;
+    }
+
+    // only the state is encoded here, the persistence thread writes it
+    // once the blocks it covers are in the segments and then prunes
+    Checkpoint checkpoint;
+    checkpoint.height = chain.size();
+    checkpoint.snapshot = encodeSnapshot(chain);
+    if (_pruneDepth > 0 && chain.size() > _pruneDepth)
+    {
+        checkpoint.pruneHeight = chain.size() - _pruneDepth;
+        _pruningHeight = std::max<std::uint64_t>(_pruningHeight, checkpoint.pruneHeight);
+    }
+
+    _snapshotHeight = checkpoint.height;
+
+    {
+        // a checkpoint that is still waiting is replaced by the newer one
+        std::lock_guard<std::mutex> lock{_pendingMutex};
+        _checkpoint = std::move(checkpoint);
+    }
+
+    _pendingReady.notify_one();
+}
+
+// rewrites the whole segments before `height` with pruned records, the
+// last segment is never pruned since blocks are still appended to it.
+// Runs on the persistence thread, so no blocks are appended meanwhile.
+void ChainDatabase::prune(std::uint64_t height)
+{
+    // a snapshot the pruned blocks can be restored from has to remain,
+    // and the oldest one is used when the newest cannot be
+    const auto snapshots = FindSnapshots(_path);
+    if (snapshots.empty())
+    {
+        return;
+    }
+
+    height = std::min(height, snapshots.back());
+
+    std::vector<db::BlockLocation> locations;
+    std::vector<std::string> segments;
+    {
+        std::lock_guard<std::mutex> lock{_locationsMutex};
+        locations = _locations;
+        segments = _segments;
+    }
+
+    const std::size_t prunedHeight = _prunedHeight;
+    std::size_t first = prunedHeight;
+    db::MemoryWriter record;
+    while (first < locations.size())
+    {
+        const auto segment = locations[first].segment;
+        auto end = first;
+        while (end < locations.size() && locations[end].segment == segment)
+        {
+            end++;
+        }
+
+        if (segment + 1u >= segments.size() || end > height)
+        {
+            break;
+        }
+
+        _logger->debug("pruning the transactions of blocks #{}-#{}", first, end - 1);
+
+        const auto segmentfile = _path / segments.at(segment);
+        const boost::filesystem::path tempfile{ segmentfile.string() + TempSuffix.data() };
+        {
+            std::ofstream ofs(tempfile.c_str(), std::ios::trunc | std::ios::out | std::ios::binary);
+            write_header(ofs);
+            for (auto idx = first; idx < end; idx++)
+            {
+                auto block = readBlock(idx);
+                if (!block.has_value())
+                {
+                    throw std::logic_error(fmt::format("could not read block #{} to prune it", idx));
+                }
+
+                block->dropTransactions();
+                record.clear();
+                record.reserve(record_size(*block));
+                write_record(record, *block);
+
+                locations[idx].offset = static_cast<std::uint64_t>(ofs.tellp());
+                locations[idx].length = static_cast<std::uint32_t>(record.size());
+                ofs.write(record.data(), record.size());
+            }
+
+            // the segment is only replaced by a complete copy
+            if (!ofs.flush())
+            {
+                throw std::logic_error(fmt::format("could not write {}", tempfile.string()));
+            }
+        }
+
+        utils::syncFile(tempfile.string());
+
+        {
+            // readers keep the old segment mapped until they are done with it
+            std::lock_guard<std::mutex> lock{_locationsMutex};
+            boost::filesystem::rename(tempfile, segmentfile);
+            _mappings.at(segment).reset();
+            std::copy(locations.begin() + first, locations.begin() + end, _locations.begin() + first);
+        }
+
+        first = end;
+        _prunedHeight = end;
+    }
+
+    // the block index is rebuilt on load if this does not finish
+    std::lock_guard<std::mutex> lock{_locationsMutex};
+    if (first > prunedHeight)
+    {
+        const boost::filesystem::path tempindex{ _indexfile.string() + TempSuffix.data() };
+        WriteIndexFile(tempindex, _locations);
+        boost::filesystem::rename(tempindex, _indexfile);
+    }
+}
+
+void ChainDatabase::writeSnapshot(const Blockchain& chain)
+{
+    saveSnapshot(chain.size(), encodeSnapshot(chain));
+    _snapshotHeight = chain.size();
+}
+
+db::MemoryWriter ChainDatabase::encodeSnapshot(const Blockchain& chain) const
+{
+    const std::uint64_t height = chain.size();
+
+    db::MemoryWriter writer;
+    writer.append(SnapshotMagic.data(), SnapshotMagic.size());
+    ash::db::write_data<std::uint32_t>(writer, SnapshotFormat);
+    ash::db::write_data<std::uint64_t>(writer, height);
+    ash::db::write_data(writer, chain.back().hash());
+
+    ash::db::write_data<std::uint64_t>(writer, chain._unspent.size());
+    for (const auto& [pt, txout] : chain._unspent)
+    {
+        write_data(writer, pt);
+        write_data(writer, txout);
+    }
+
+    ash::db::write_data<std::uint64_t>(writer, chain._spentTxOuts.size());
+    for (const auto& spent : chain._spentTxOuts)
+    {
+        ash::db::write_data<std::uint64_t>(writer, spent.size());
+        for (const auto& pt : spent)
+        {
+            write_data(writer, pt);
+            ash::db::write_data(writer, pt.address.value_or(std::string{}));
+            ash::db::write_data(writer, pt.amount.value_or(0.0));
+        }
+    }
+
+    ash::db::write_data<std::uint64_t>(writer, chain._ledgers.size());
+    for (const auto& [address, ledger] : chain._ledgers)
+    {
+        ash::db::write_data(writer, address);
+        ash::db::write_data<std::uint64_t>(writer, ledger.size());
+        for (const auto& entry : ledger)
+        {
+            ash::db::write_data<std::uint64_t>(writer, entry.blockIdx);
+            ash::db::write_data(writer, entry.txid);
+            ash::db::write_data<std::uint64_t>(writer, 
+                static_cast<std::uint64_t>(entry.time.time_since_epoch().count()));
+            ash::db::write_data(writer, entry.amount);
+        }
+    }
+
+    ash::db::write_data<std::uint64_t>(writer, chain._cumDifficulty.size());
+    for (const auto work : chain._cumDifficulty)
+    {
+        ash::db::write_data<std::uint64_t>(writer, work);
+    }
+
+    ash::db::write_data<std::uint32_t>(writer, 
+        crypto::CRC32C(std::string_view{ writer.data(), writer.size() }));
+
+    return writer;
+}
+
+void ChainDatabase::saveSnapshot(std::uint64_t height, const db::MemoryWriter& writer)
+{
+    _logger->debug("writing a snapshot of the chain state at {} blocks", height);
+
+    // the snapshot replaces an older one in one rename so a crash 
+    // leaves either the whole snapshot or none
+    const auto snapshotfile = _path / SnapshotFileName(height);
+    const boost::filesystem::path tempfile{ snapshotfile.string() + TempSuffix.data() };
+
+    {
+        std::ofstream ofs(tempfile.c_str(), std::ios::trunc | std::ios::out | std::ios::binary);
+        ofs.write(writer.data(), static_cast<std::streamsize>(writer.size()));
+        if (!ofs)
+        {
+            throw std::logic_error(fmt::format("could not write snapshot {}", tempfile.string()));
+        }
+    }
+
+    utils::syncFile(tempfile.string());
+    boost::filesystem::rename(tempfile, snapshotfile);
+
+    // the snapshots past `height` are of blocks that are being removed
+    // and are left for the truncation to delete
+    std::size_t kept = 0;
+    for (const auto snapshot : FindSnapshots(_path))
+    {
+        if (snapshot <= height && ++kept > SnapshotsKept)
+        {
+            boost::filesystem::remove(_path / SnapshotFileName(snapshot));
+        }
+    }
+}
+
+std::optional<std::string> ChainDatabase::restoreSnapshot(Blockchain& chain, 
+    const std::optional<std::vector<db::BlockLocation>>& locations)
+{
+    assert(chain.size() == 0);
+
+    for (const auto height : FindSnapshots(_path))
+    {
+        const auto snapshotfile = _path / SnapshotFileName(height);
+
+        // the saved index tells which snapshots the segments still reach
+        if (height == 0 || (locations.has_value() && height > locations->size()))
+        {
+            continue;
+        }
+
+        std::string data;
+        {
+            std::ifstream ifs(snapshotfile.c_str(), std::ios_base::binary);
+            data.assign(std::istreambuf_iterator<char>{ ifs }, std::istreambuf_iterator<char>{});
+        }
+
+        constexpr auto crcSize = sizeof(std::uint32_t);
+        if (data.size() < SnapshotMagic.size() + crcSize)
+        {
+            _logger->warn("ignoring the snapshot {} that was cut short", snapshotfile.string());
+            continue;
+        }
+
+        db::MemoryReader reader{ data.data(), data.size() - crcSize };
+        db::MemoryReader crcReader{ data.data() + reader.remaining(), crcSize };
+
+        std::uint32_t crc = 0;
+        ash::db::read_data(crcReader, crc);
+        if (crc != crypto::CRC32C(std::string_view{ data.data(), data.size() - crcSize })
+            || reader.view(SnapshotMagic.size()) != SnapshotMagic)
+        {
+            _logger->warn("ignoring the corrupt snapshot {}", snapshotfile.string());
+            continue;
+        }
+
+        std::uint32_t format = 0;
+        std::uint64_t blockCount = 0;
+        std::string hash;
+        ash::db::read_data(reader, format);
+        ash::db::read_data(reader, blockCount);
+        ash::db::read_data(reader, hash);
+        if (!reader || format != SnapshotFormat || blockCount != height)
+        {
+            _logger->warn("ignoring the snapshot {} with format {}", snapshotfile.string(), format);
+            continue;
+        }
+        else if (locations.has_value() && locations->at(height - 1).hash != hash)
+        {
+            _logger->warn("ignoring the snapshot {} of another chain", snapshotfile.string());
+            continue;
+        }
+
+        // decoded in full before the chain is touched
+        std::vector<std::pair<TxOutPoint, TxOut>> unspent;
+        std::uint64_t count = 0;
+        ash::db::read_data(reader, count);
+        unspent.reserve(std::min<std::size_t>(count, reader.remaining()));
+        for (std::uint64_t idx = 0; idx < count && reader; idx++)
+        {
+            auto& [pt, txout] = unspent.emplace_back();
+            read_data(reader, pt);
+            read_data(reader, txout);
+        }
+
+        SegmentedVector<UnspentTxOuts> spentTxOuts;
+        ash::db::read_data(reader, count);
+        for (std::uint64_t idx = 0; idx < count && reader; idx++)
+        {
+            auto& spent = spentTxOuts.emplace_back();
+
+            std::uint64_t spentCount = 0;
+            ash::db::read_data(reader, spentCount);
+            spent.reserve(std::min<std::size_t>(spentCount, reader.remaining()));
+            for (std::uint64_t x = 0; x < spentCount && reader; x++)
+            {
+                auto& pt = spent.emplace_back();
+                read_data(reader, pt);
+
+                std::string address;
+                double amount = 0.0;
+                ash::db::read_data(reader, address);
+                ash::db::read_data(reader, amount);
+                pt.address = std::move(address);
+                pt.amount = amount;
+            }
+        }
+
+        ShardedMap<std::string, AddressLedger> ledgers;
+        ash::db::read_data(reader, count);
+        for (std::uint64_t idx = 0; idx < count && reader; idx++)
+        {
+            std::string address;
+            std::uint64_t entryCount = 0;
+            ash::db::read_data(reader, address);
+            ash::db::read_data(reader, entryCount);
+
+            auto& ledger = ledgers[address];
+            ledger.reserve(std::min<std::size_t>(entryCount, reader.remaining()));
+            for (std::uint64_t x = 0; x < entryCount && reader; x++)
+            {
+                auto& entry = ledger.emplace_back();
+
+                std::uint64_t dtime = 0;
+                ash::db::read_data(reader, entry.blockIdx);
+                ash::db::read_data(reader, entry.txid);
+                ash::db::read_data(reader, dtime);
+                ash::db::read_data(reader, entry.amount);
+                entry.time = BlockTime{ std::chrono::milliseconds{ dtime } };
+            }
+        }
+
+        SegmentedVector<std::uint64_t> cumDifficulty;
+        ash::db::read_data(reader, count);
+        for (std::uint64_t idx = 0; idx < count && reader; idx++)
+        {
+            ash::db::read_data(reader, cumDifficulty.emplace_back());
+        }
+
+        if (!reader || !reader.eof()
+            || spentTxOuts.size() != height
+            || cumDifficulty.size() != height + 1)
+        {
+            _logger->warn("ignoring the snapshot {} that could not be read", snapshotfile.string());
+            continue;
+        }
+
+        chain.clear();
+        for (const auto& [pt, txout] : unspent)
+        {
+            chain.addUnspent(pt, txout);
+        }
+
+        chain._spentTxOuts = std::move(spentTxOuts);
+        chain._ledgers = std::move(ledgers);
+        chain._cumDifficulty = std::move(cumDifficulty);
+
+        _logger->info("restored the chain state at {} blocks from {}", height, snapshotfile.string());
+        _snapshotHeight = height;
+        return hash;
+    }
+
+    _snapshotHeight = 0;
+    return {};
+}
+
+// removes the snapshots that cover more than `height` blocks
+void ChainDatabase::removeSnapshots(std::uint64_t height)
+{
+    _snapshotHeight = 0;
+    for (const auto snapshot : FindSnapshots(_path))
+    {
+        if (snapshot > height)
+        {
+            boost::filesystem::remove(_path / SnapshotFileName(snapshot));
+        }
+        else
+        {
+            _snapshotHeight = std::max(_snapshotHeight, snapshot);
+        }
     }
 }
 
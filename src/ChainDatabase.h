@@ -1,12 +1,25 @@
 #pragma once
 #include <string_view>
 #include <optional>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
 
 #include "Block.h"
+#include "Blockchain.h"
 #include "AshLogger.h"
 
 namespace ash
@@ -62,33 +75,373 @@ inline void read_data(std::istream& stream, std::string& data)
     stream.read(reinterpret_cast<PointerType>(data.data()), len);
 }
 
+//! Decodes the database encoding straight out of memory, such as a
+//  mapped file, instead of going through a stream. Reading past the
+//  end fails the reader like a stream's failbit.
+class MemoryReader final
+{
+    const char*     _data;
+    std::size_t     _size;
+    std::size_t     _pos = 0;
+    bool            _good = true;
+
+public:
+    MemoryReader(const char* data, std::size_t size)
+        : _data{ data }, _size{ size }
+    {
+    }
+
+    std::size_t position() const noexcept { return _pos; }
+    std::size_t remaining() const noexcept { return _size - _pos; }
+    bool eof() const noexcept { return _pos >= _size; }
+
+    explicit operator bool() const noexcept { return _good; }
+    bool operator!() const noexcept { return !_good; }
+
+    void clear() noexcept { _good = true; }
+    void invalidate() noexcept { _good = false; }
+
+    void seek(std::size_t pos)
+    {
+        _good = _good && pos <= _size;
+        _pos = std::min(pos, _size);
+    }
+
+    // the next `count` bytes, which stay valid as long as the memory
+    std::string_view view(std::size_t count)
+    {
+        if (!_good || count > _size - _pos)
+        {
+            _good = false;
+            _pos = _size;
+            return {};
+        }
+
+        std::string_view retval{ _data + _pos, count };
+        _pos += count;
+        return retval;
+    }
+};
+
+template<typename T,
+    typename = typename std::enable_if<(std::is_integral<T>::value)>::type>
+inline void read_data(MemoryReader& reader, T& value)
+{
+    if (const auto bytes = reader.view(sizeof(value)); reader)
+    {
+        std::memcpy(&value, bytes.data(), sizeof(value));
+    }
+}
+
+inline void read_data(MemoryReader& reader, double& val)
+{
+    if (const auto bytes = reader.view(sizeof(double)); reader)
+    {
+        std::memcpy(&val, bytes.data(), sizeof(double));
+    }
+}
+
+// a view into the reader's memory, so nothing is copied
+inline void read_data(MemoryReader& reader, std::string_view& data)
+{
+    StrLenType len = 0;
+    read_data(reader, len);
+    data = reader.view(len);
+}
+
+inline void read_data(MemoryReader& reader, std::string& data)
+{
+    std::string_view view;
+    read_data(reader, view);
+    data.assign(view);
+}
+
+//! Encodes the database encoding into one contiguous buffer, so a
+//  record sized up front with `encoded_size()` is built without 
+//  reallocating and is written to a file in a single call
+class MemoryWriter final
+{
+    std::string     _buffer;
+
+public:
+    void reserve(std::size_t size) { _buffer.reserve(size); }
+    void clear() noexcept { _buffer.clear(); }
+
+    const char* data() const noexcept { return _buffer.data(); }
+    std::size_t size() const noexcept { return _buffer.size(); }
+
+    void append(const void* data, std::size_t count)
+    {
+        _buffer.append(static_cast<const char*>(data), count);
+    }
+};
+
+template <typename T,
+    typename = typename std::enable_if<(std::is_integral<T>::value)>::type>
+inline void write_data(MemoryWriter& writer, T value)
+{
+    writer.append(&value, sizeof(value));
+}
+
+inline void write_data(MemoryWriter& writer, double val)
+{
+    writer.append(&val, sizeof(double));
+}
+
+inline void write_data(MemoryWriter& writer, std::string_view data)
+{
+    write_data(writer, static_cast<StrLenType>(data.size()));
+    writer.append(data.data(), data.size());
+}
+
+// the number of bytes `write_data()` writes for a string
+constexpr std::size_t encoded_size(std::string_view data)
+{
+    return sizeof(StrLenType) + data.size();
+}
+
+class MappedFile;
+
+// how durable a written block is before the next one can be written
+enum class SyncMode
+{
+    None,   // the blocks are handed to the OS and never synced
+    Group,  // each group of appended blocks is synced to disk
+    Full    // like Group, and writing waits until the block is synced
+};
+
+// how the LevelDB txid index is tuned, larger buffers make bulk imports
+// faster and the bloom filter saves disk reads for missing txids
+struct TxIndexOptions
+{
+    std::size_t     cacheSize = 8u * 1024u * 1024u;         // bytes of index blocks cached
+    std::uint32_t   bloomBits = 10;                         // bits per key, 0 turns it off
+    std::size_t     writeBufferSize = 16u * 1024u * 1024u;  // bytes buffered before a table is written
+};
+
+// where the record of a block is in the segment files of the database
+struct BlockLocation
+{
+    std::uint32_t   segment;
+    std::uint64_t   offset;
+    std::uint32_t   length;
+    std::string     hash;
+
+    bool operator==(const BlockLocation& rhs) const
+    {
+        return segment == rhs.segment
+            && offset == rhs.offset
+            && length == rhs.length
+            && hash == rhs.hash;
+    }
+
+    bool operator!=(const BlockLocation& rhs) const
+    {
+        return !operator==(rhs);
+    }
+};
+
 } // namespace ash::db
 
+// writes the database record of `block` to `stream` in one call
+void write_block(std::ostream& stream, const Block& block);
+
+// a new segment file is started when a block would take the current
+// segment past this size
+constexpr auto DatabaseFileSizeDefault = 1024u * 1024u * 5u;
+
+// the number of written blocks that can wait to be appended before
+// writing another block waits for them
+constexpr std::size_t WriteQueueSize = 1024;
+
+// a snapshot of the state derived from the blocks is written each time
+// the chain has grown this many blocks
+constexpr auto SnapshotIntervalDefault = 1000u;
+
 class ChainDatabase;
 using ChainDatabasePtr = std::unique_ptr<ChainDatabase>;
 
-class ChainDatabase final
+class ChainDatabase final : public BlockReader
 {
 
 public:
     using GenesisCallback = std::function<Block(void)>;
 
-    ChainDatabase(std::string_view folder);
+    ChainDatabase(std::string_view folder, 
+        std::uint64_t maxFileSize = DatabaseFileSizeDefault,
+        db::SyncMode syncMode = db::SyncMode::Group);
     ~ChainDatabase();
 
+    // queues the block for the persistence thread, which appends the 
+    // queued blocks as one group, so the block can be read back only
+    // after it has been appended or after flush(). Once a group could
+    // not be appended, this and flush() throw its error until reset()
+    // or replaceChain() rewrites the files, or truncateTo() removes
+    // blocks that were appended before the failed group.
     void write(const Block& block);
     void writeChain(const Blockchain& chain);
 
+    // waits until every queued block has been appended
+    void flush();
+
     void initialize(Blockchain& chain, GenesisCallback gcb);
     void reset();
 
+    // replaces the database files with `chain`, the blocks are written 
+    // to new files first so a chain that only keeps its headers can
+    // still load its blocks from the current files
+    void replaceChain(const Blockchain& chain);
+
+    // removes the blocks from `index` on by truncating the segment that
+    // holds the block, deleting the segments after it and truncating 
+    // the block index, so a reorg only appends the blocks that replace 
+    // them instead of rewriting the chain. Throws when the pruned blocks
+    // that remain would not be covered by a snapshot. Cutting the tail
+    // also cuts off what a failed group left, which clears its error.
+    void truncateTo(std::size_t index);
+
+    // truncates the database to the blocks of `chain`, which was already
+    // rolled back, and writes a snapshot of `chain` first when the pruned
+    // blocks that remain would not be covered by one
+    void truncateTo(const Blockchain& chain);
+
+    // the number of segment files the blocks are stored in
+    std::size_t segmentCount() const;
+
+    // writes a snapshot of the unspent TxOuts, the ledgers and the total
+    // work of `chain` once it has grown `interval` blocks past the last
+    // snapshot, so loading the chain only replays the blocks after the
+    // newest snapshot. An interval of 0 turns the snapshots off.
+    void setSnapshotInterval(std::uint64_t interval) noexcept { _snapshotInterval = interval; }
+
+    // keeps the transactions of only the last `depth` blocks, each time
+    // a snapshot is written the segments before both the last `depth` 
+    // blocks and the oldest snapshot are rewritten with only the headers
+    // of their blocks. A depth of 0 keeps every block.
+    void setPruneDepth(std::uint64_t depth) noexcept { _pruneDepth = depth; }
+
+    // the blocks before this height have had their transactions
+    // discarded, or are about to by the persistence thread, and can
+    // no longer be rolled back
+    std::uint64_t prunedHeight() const noexcept 
+    { 
+        return std::max<std::uint64_t>(_prunedHeight, _pruningHeight); 
+    }
+
+    // the options the txid index is opened with by initialize()
+    void setTxIndexOptions(const db::TxIndexOptions& options) { _txIndexOptions = options; }
+
+    // queues a snapshot of `chain` when one is due, which the persistence
+    // thread writes once the blocks it covers are appended and prunes 
+    // the database after. The rollback data of the blocks pruned since
+    // the last call is freed from `chain`.
+    void checkpoint(Blockchain& chain);
+
+    bool hasBlock(std::size_t index, std::string_view hash) const override;
+    std::optional<Block> readBlock(std::size_t index) const override;
+
+    // the location of `txid` according to the txid index, entries can
+    // be stale after the chain is rewritten so callers should check the
+    // result against the chain
+    std::optional<TxPoint> findTransaction(std::string_view txid) const;
+
+    // true once every written block is in the txid index, until then
+    // a transaction missing from the index may still be in the chain
+    bool txIndexReady() const noexcept { return _txIndexReady && _unwritten == 0; }
+
 private:
+    // a snapshot waiting for the persistence thread and the height the
+    // database is pruned to after it is written
+    struct Checkpoint
+    {
+        std::uint64_t       height = 0;
+        db::MemoryWriter    snapshot;
+        std::uint64_t       pruneHeight = 0;
+    };
+
+    void runWriter();
+    bool writerIdle() const;
+    std::unique_lock<std::mutex> pauseWriter();
+    void writeCheckpoint(const Checkpoint& checkpoint);
+
+    void addLocation(db::BlockLocation location);
+    void addSegments(std::size_t count);
+    boost::filesystem::path segmentPath(std::size_t segment) const;
+    void appendLocations(std::vector<db::BlockLocation> locations);
+    void indexBlock(leveldb::WriteBatch& batch, const Block& block);
+    void writeTxIndexHeight(leveldb::WriteBatch& batch, std::uint64_t height);
+    void writeTxIndex(leveldb::WriteBatch& batch);
+    std::optional<std::uint64_t> readTxIndexHeight() const;
+
+    void writeSnapshot(const Blockchain& chain);
+    db::MemoryWriter encodeSnapshot(const Blockchain& chain) const;
+    void saveSnapshot(std::uint64_t height, const db::MemoryWriter& snapshot);
+    std::optional<std::string> restoreSnapshot(Blockchain& chain, 
+        const std::optional<std::vector<db::BlockLocation>>& locations);
+    void removeSnapshots(std::uint64_t height);
+    void truncate(std::size_t index, const Blockchain* chain);
+    void prune(std::uint64_t height);
+
     std::string                 _folder;
 
     boost::filesystem::path     _path;
     boost::filesystem::path     _dbfile;
+    boost::filesystem::path     _indexfile;     // the location of each block in the segments
+    boost::filesystem::path     _manifestfile;  // the names of the segment files
+    std::uint64_t               _maxFileSize;
     // ash::db::LevelDBPtr         _txInIndex;
     leveldb::DB*                _txIndex = nullptr;
+    db::TxIndexOptions          _txIndexOptions;
+    std::unique_ptr<leveldb::Cache>                 _txIndexCache;
+    std::unique_ptr<const leveldb::FilterPolicy>    _txIndexFilter;
+
+    // the location of each block, as saved in the index file, the
+    // segment file names, as saved in the manifest, and the format of 
+    // the files, read by the threads that load blocks
+    std::vector<db::BlockLocation>  _locations;
+    std::vector<std::string>        _segments;
+    std::uint32_t                   _format;
+    mutable std::mutex              _locationsMutex;
+
+    // the segments mapped for reading, the last segment is remapped 
+    // once it has grown past its mapping. Readers hold on to the 
+    // mapping they used.
+    mutable std::vector<std::shared_ptr<const db::MappedFile>>  _mappings;
+
+    // held shared while a block is decoded from a mapping and 
+    // exclusively while a segment is truncated under its mapping
+    mutable std::shared_mutex                       _truncateMutex;
+
+    std::thread                 _txIndexThread;     // rebuilds a missing txid index
+    std::atomic_bool            _txIndexReady = false;
+    std::atomic_bool            _stopIndexing = false;
+    std::atomic_uint64_t        _blockCount = 0;    // blocks in the database file
+
+    // the blocks waiting for the persistence thread, which keeps the
+    // last segment open between groups
+    db::SyncMode                _syncMode;
+    std::deque<Block>           _pending;
+    std::size_t                 _writing = 0;       // blocks of the group being appended
+    std::uint64_t               _queued = 0;        // blocks ever queued
+    std::uint64_t               _committed = 0;     // queued blocks that were appended
+    std::exception_ptr          _writeError;        // why the last group could not be appended
+    std::optional<Checkpoint>   _checkpoint;        // written after the blocks queued before it
+    bool                        _checkpointing = false;   // the thread is writing a checkpoint
+    bool                        _reopenSegment = false;
+    bool                        _stopWriting = false;
+    std::atomic_size_t          _unwritten = 0;     // queued blocks not in the txid index yet
+    std::mutex                  _pendingMutex;
+    std::condition_variable     _pendingReady;      // work was queued or the thread should stop
+    std::condition_variable     _pendingDone;       // a group was taken or appended
+    std::thread                 _writeThread;
+
+    // the blocks between snapshots and the blocks the newest snapshot
+    // covers, only used by the thread that owns the chain
+    std::uint64_t               _snapshotInterval = SnapshotIntervalDefault;
+    std::uint64_t               _snapshotHeight = 0;
+    std::uint64_t               _pruneDepth = 0;
+    std::atomic_uint64_t        _prunedHeight = 0;
+    std::atomic_uint64_t        _pruningHeight = 0; // the height the queued checkpoints prune to
     
     SpdLogPtr                   _logger;
 };
@@ -0,0 +1,168 @@
+#include <charconv>
+
+#include <cryptopp/sha.h>
+
+#include "AshUtils.h"
+#include "Block.h"
+#include "MerkleTree.h"
+
+namespace ash
+{
+
+namespace
+{
+
+constexpr std::uint8_t LeafPrefix = 0x00;
+constexpr std::uint8_t NodePrefix = 0x01;
+
+std::vector<HashDigest> GetLeaves(const Transactions& txs)
+{
+    std::vector<HashDigest> leaves(txs.size());
+    utils::ParallelFor(txs.size(), MERKLE_PARALLEL_THRESHOLD,
+        [&txs, &leaves](std::size_t begin, std::size_t end)
+        {
+            for (auto idx = begin; idx < end; idx++)
+            {
+                leaves[idx] = GetMerkleLeaf(txs[idx]);
+            }
+        });
+
+    return leaves;
+}
+
+std::vector<HashDigest> GetNextLevel(const std::vector<HashDigest>& level)
+{
+    std::vector<HashDigest> next((level.size() + 1) / 2);
+    utils::ParallelFor(next.size(), MERKLE_PARALLEL_THRESHOLD,
+        [&level, &next](std::size_t begin, std::size_t end)
+        {
+            for (auto idx = begin; idx < end; idx++)
+            {
+                const auto left = idx * 2;
+                next[idx] = (left + 1 < level.size())
+                    ? GetMerkleNode(level[left], level[left + 1])
+                    : level[left];
+            }
+        });
+
+    return next;
+}
+
+HashDigest DigestFromHex(std::string_view hex)
+{
+    HashDigest digest;
+    if (hex.size() != digest.size() * 2)
+    {
+        throw std::logic_error(fmt::format("invalid merkle hash '{}'", hex));
+    }
+
+    for (std::size_t idx = 0; idx < digest.size(); idx++)
+    {
+        const auto start = hex.data() + (idx * 2);
+        const auto result = std::from_chars(start, start + 2, digest[idx], 16);
+        if (result.ec != std::errc{} || result.ptr != start + 2)
+        {
+            throw std::logic_error(fmt::format("invalid merkle hash '{}'", hex));
+        }
+    }
+
+    return digest;
+}
+
+} // namespace
+
+void to_json(nl::json& j, const MerkleBranch& branch)
+{
+    j["hash"] = ToHexString(branch.hash);
+    j["left"] = branch.left;
+}
+
+void from_json(const nl::json& j, MerkleBranch& branch)
+{
+    branch.hash = DigestFromHex(j["hash"].get<std::string>());
+    j["left"].get_to(branch.left);
+}
+
+HashDigest GetMerkleLeaf(const Transaction& tx)
+{
+    const auto txhash = GetTransactionHash(tx);
+
+    CryptoPP::SHA256 hash;
+    hash.Update(&LeafPrefix, sizeof(LeafPrefix));
+    hash.Update(txhash.data(), txhash.size());
+
+    HashDigest digest;
+    hash.Final(digest.data());
+    return digest;
+}
+
+HashDigest GetMerkleNode(const HashDigest& left, const HashDigest& right)
+{
+    CryptoPP::SHA256 hash;
+    hash.Update(&NodePrefix, sizeof(NodePrefix));
+    hash.Update(left.data(), left.size());
+    hash.Update(right.data(), right.size());
+
+    HashDigest digest;
+    hash.Final(digest.data());
+    return digest;
+}
+
+HashDigest GetMerkleRoot(const Transactions& txs)
+{
+    if (txs.empty())
+    {
+        HashDigest digest;
+        CryptoPP::SHA256{}.Final(digest.data());
+        return digest;
+    }
+
+    auto level = GetLeaves(txs);
+    while (level.size() > 1)
+    {
+        level = GetNextLevel(level);
+    }
+
+    return level.front();
+}
+
+MerkleProof GetMerkleProof(const Transactions& txs, std::size_t txIndex)
+{
+    if (txIndex >= txs.size())
+    {
+        throw std::logic_error(fmt::format("transaction index {} is out of range", txIndex));
+    }
+
+    MerkleProof proof;
+
+    auto level = GetLeaves(txs);
+    auto index = txIndex;
+    while (level.size() > 1)
+    {
+        const auto sibling = index ^ 1;
+        if (sibling < level.size())
+        {
+            proof.push_back(MerkleBranch{ level[sibling], sibling < index });
+        }
+
+        level = GetNextLevel(level);
+        index /= 2;
+    }
+
+    return proof;
+}
+
+bool VerifyMerkleProof(const Transaction& tx, const MerkleProof& proof, const HashDigest& root)
+{
+    auto digest = GetMerkleLeaf(tx);
+    for (const auto& branch : proof)
+    {
+        digest = branch.left
+            ? GetMerkleNode(branch.hash, digest)
+            : GetMerkleNode(digest, branch.hash);
+    }
+
+    return digest == root;
+}
+
+} // namespace ash
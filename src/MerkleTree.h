@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "Transactions.h"
+
+namespace nl = nlohmann;
+
+namespace ash
+{
+
+// levels with at least this many nodes per worker are hashed
+// on multiple threads
+constexpr std::size_t MERKLE_PARALLEL_THRESHOLD = 1024;
+
+//! One step of an inclusion proof, the sibling of the node on
+//  the path from the leaf to the root
+struct MerkleBranch
+{
+    HashDigest  hash;
+    bool        left;   // the sibling is on the left
+};
+
+using MerkleProof = std::vector<MerkleBranch>;
+
+void to_json(nl::json& j, const MerkleBranch& branch);
+void from_json(const nl::json& j, MerkleBranch& branch);
+
+// the leaves are the domain separated hashes of the transactions and a
+// node without a sibling moves up to the next level unchanged, so no
+// two lists of transactions share a root
+HashDigest GetMerkleLeaf(const Transaction& tx);
+HashDigest GetMerkleNode(const HashDigest& left, const HashDigest& right);
+
+// hashes the leaves and every level of the tree, levels that are large
+// enough are split across std::thread::hardware_concurrency() threads
+HashDigest GetMerkleRoot(const Transactions& txs);
+
+MerkleProof GetMerkleProof(const Transactions& txs, std::size_t txIndex);
+
+bool VerifyMerkleProof(const Transaction& tx, const MerkleProof& proof, const HashDigest& root);
+
+} // namespace ash
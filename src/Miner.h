@@ -1,4 +1,7 @@
 #pragma once
+#include <thread>
+#include <vector>
+
 #include "Block.h"
 #include "AshLogger.h"
 #include "CryptoUtils.h"
@@ -14,6 +17,7 @@ class Miner
     std::uint64_t       _maxTries = 0;
     std::atomic_bool    _keepTrying = true;
     std::uint32_t       _timeout; // seconds
+    std::uint32_t       _threadCount = 1;
     SpdLogPtr           _logger;
 
 public:
@@ -36,6 +40,9 @@ public:
     std::uint64_t difficulty() const noexcept { return _difficulty; }
     void setDifficulty(std::uint64_t val) { _difficulty = val; }
 
+    std::uint32_t threadCount() const noexcept { return _threadCount; }
+    void setThreadCount(std::uint32_t val) { _threadCount = std::max(val, 1u); }
+
     void abort() 
     { 
         _keepTrying.store(false, std::memory_order_release);
@@ -48,51 +55,115 @@ public:
         assert(block.index() > 0);
         assert(block.previousHash().size() > 0 || (block.index() - 1 == 0));
 
-        std::string zeros;
-        zeros.assign(_difficulty, '0');
-
-        std::uint64_t nonce = 0;
-        auto time = 
-            std::chrono::time_point_cast<std::chrono::milliseconds>
-                (std::chrono::system_clock::now());
+        const auto extra = block.txDigest();
 
-        const auto extra = 
-            ash::crypto::SHA256(nl::json(block.transactions()).dump());
+        _keepTrying = true;
 
-        std::string hash = 
-            CalculateBlockHash(
-                block.index(), nonce, _difficulty, time, block.data(), block.previousHash(), extra);
+        // the nonce space is interleaved across the workers, so worker `n`
+        // tries nonces n, n + threadCount, n + 2*threadCount, ...
+        std::atomic_bool found = false;
+        std::atomic_bool bailed = false;
 
-        _keepTrying = true;
+        std::uint64_t winningNonce = 0;
+        BlockTime winningTime;
+        HashDigest winningDigest;
 
-        while (_keepTrying.load(std::memory_order_acquire) 
-            && hash.compare(0, _difficulty, zeros) != 0)
-        {
-            // do some extra stuff every few seconds
-            if ((nonce & 0x3ffff) == 0)
+        auto worker = 
+            [&](std::uint32_t workerIdx)
             {
-                if (keepGoingFunc && !keepGoingFunc(block.index()))
+                std::uint64_t nonce = workerIdx;
+                std::uint64_t tries = 0;
+                auto time = 
+                    std::chrono::time_point_cast<std::chrono::milliseconds>
+                        (std::chrono::system_clock::now());
+
+                BlockHasher hasher{ block.index(), _difficulty, block.data(), block.previousHash(), extra };
+                hasher.setTime(time);
+
+                // each pass hashes `lanes` nonces at once with the SIMD kernel, 
+                // nothing in this loop allocates and the digest is only hex
+                // encoded once for the winning hash
+                const auto lanes = hasher.lanes();
+                assert(lanes > 0 && (lanes & (lanes - 1)) == 0);
+
+                std::array<HashDigest, crypto::SHA256MaxLanes> digests;
+                auto winningLane = 
+                    [&]() -> std::size_t
+                    {
+                        for (std::size_t lane = 0; lane < lanes; lane++)
+                        {
+                            if (HasLeadingZeros(digests[lane], _difficulty)) return lane;
+                        }
+                        return lanes;
+                    };
+
+                hasher.hash(nonce, _threadCount, lanes, digests.data());
+                auto lane = winningLane();
+
+                while (_keepTrying.load(std::memory_order_acquire) && lane == lanes)
                 {
-                    // our callback has told us to bail
-                    return ResultType::ABORT;
+                    // do some extra stuff every few seconds
+                    if ((tries & 0x3ffff) == 0)
+                    {
+                        // only the first worker polls the callback, the
+                        // others are stopped through `_keepTrying`
+                        if (workerIdx == 0 
+                            && keepGoingFunc && !keepGoingFunc(block.index()))
+                        {
+                            // our callback has told us to bail
+                            bailed = true;
+                            abort();
+                            return;
+                        }
+
+                        // update the block time
+                        time = std::chrono::time_point_cast<std::chrono::milliseconds>
+                                (std::chrono::system_clock::now());
+                        hasher.setTime(time);
+                    }
+
+                    tries += lanes;
+                    nonce += lanes * _threadCount;
+                    hasher.hash(nonce, _threadCount, lanes, digests.data());
+                    lane = winningLane();
                 }
 
-                // update the block time
-                time = std::chrono::time_point_cast<std::chrono::milliseconds>
-                        (std::chrono::system_clock::now());
+                if (lane < lanes && !found.exchange(true))
+                {
+                    winningNonce = nonce + (lane * _threadCount);
+                    winningTime = time;
+                    winningDigest = digests[lane];
+
+                    // stop the other workers
+                    abort();
+                }
+            };
+
+        if (_threadCount == 1)
+        {
+            worker(0);
+        }
+        else
+        {
+            std::vector<std::thread> workers;
+            workers.reserve(_threadCount);
+            for (auto idx = 0u; idx < _threadCount; idx++)
+            {
+                workers.emplace_back(worker, idx);
             }
 
-            nonce++;
-            hash = CalculateBlockHash(
-                block.index(), nonce, _difficulty, time, block.data(), block.previousHash(), extra);
+            for (auto& t : workers)
+            {
+                t.join();
+            }
         }
 
-        if (!_keepTrying)
+        if (bailed || !found)
         {
             return ResultType::ABORT;
         }
 
-        block.setMinedData(nonce, _difficulty, time, hash);
+        block.setMinedData(winningNonce, _difficulty, winningTime, ToHexString(winningDigest));
 
         _logger->info("successfully mined bock {}", block.index());
         return ResultType::SUCCESS;
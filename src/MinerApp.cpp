@@ -22,6 +22,7 @@
 #include "core.h"
 #include "ComputerID.h"
 #include "Transactions.h"
+#include "MerkleTree.h"
 #include "ProblemDetails.h"
 
 #include "MinerApp.h"
@@ -50,7 +51,33 @@ MinerApp::MinerApp(SettingsPtr settings)
     _logger->debug("difficulty adjustment interval is every {} blocks", BLOCK_INTERVAL);
 
     _blockchain = std::make_unique<Blockchain>();
-    _database = std::make_unique<ChainDatabase>(dbfolder);
+    const auto maxFileSize = _settings->value("database.filesize.max", DatabaseFileSizeDefault);
+    const auto sync = _settings->value("database.sync", "group");
+    auto syncMode = db::SyncMode::Group;
+    if (boost::iequals(sync, "none"))
+    {
+        syncMode = db::SyncMode::None;
+    }
+    else if (boost::iequals(sync, "full"))
+    {
+        syncMode = db::SyncMode::Full;
+    }
+
+    _database = std::make_unique<ChainDatabase>(dbfolder, maxFileSize, syncMode);
+    _database->setSnapshotInterval(
+        _settings->value("database.snapshot.interval", SnapshotIntervalDefault));
+    _database->setPruneDepth(_settings->value("database.prune", 0u));
+
+    db::TxIndexOptions txIndexOptions;
+    txIndexOptions.cacheSize = _settings->value("database.txindex.cache.size", 
+        static_cast<std::uint32_t>(txIndexOptions.cacheSize));
+    txIndexOptions.bloomBits = _settings->value("database.txindex.bloom.bits", txIndexOptions.bloomBits);
+    txIndexOptions.writeBufferSize = _settings->value("database.txindex.writebuffer.size", 
+        static_cast<std::uint32_t>(txIndexOptions.writeBufferSize));
+    _database->setTxIndexOptions(txIndexOptions);
+
+    _miner.setThreadCount(_settings->value("mining.threads", 1u));
+    _logger->debug("mining with {} thread(s)", _miner.threadCount());
 }
 
 MinerApp::~MinerApp()
@@ -122,6 +149,37 @@ void MinerApp::servePage(HttpResponsePtr response,
     response->write(out);
 }
 
+MinerApp::ChainSnapshot MinerApp::chainSnapshot() const
+{
+    std::lock_guard<std::mutex> lock{_snapshotMutex};
+    return _snapshot;
+}
+
+void MinerApp::publishChainSnapshot()
+{
+    // copy the chain before taking the snapshot lock so readers
+    // only ever wait for the pointer swap, the copy shares the 
+    // blocks and the chain state with the chain. The previous 
+    // snapshot is freed by whichever reader releases it last.
+    auto snapshot = std::make_shared<const Blockchain>(*_blockchain);
+
+    std::lock_guard<std::mutex> lock{_snapshotMutex};
+    _snapshot.swap(snapshot);
+}
+
+void MinerApp::configureHeadersOnly()
+{
+    // a pruned database only keeps the headers of the older blocks, so
+    // the chain does as well
+    if (_settings->value("database.headersonly", false)
+        || _settings->value("database.prune", 0u) > 0)
+    {
+        const auto cacheSize = _settings->value("database.blockcache.size", BlockCacheSizeDefault);
+        _blockchain->setBlockReader(_database.get(), cacheSize);
+        _logger->debug("keeping block headers in memory with a cache of {} blocks", cacheSize);
+    }
+}
+
 void MinerApp::getStandardDictionary(utils::Dictionary& dict)
 {
     dict["%app-title%"] = APP_NAME_LONG;
@@ -166,9 +224,10 @@ void MinerApp::initWebService()
             utils::Dictionary dict;
             getStandardDictionary(dict);
 
-            dict["%chain-size%"] = std::to_string(_blockchain->size() - 1);
+            const auto chain = chainSnapshot();
+            dict["%chain-size%"] = std::to_string(chain->size() - 1);
             dict["%chain-diff%"] = std::to_string(_miner.difficulty());
-            dict["%chain-cumdiff%"] = std::to_string(_blockchain->cumDifficulty());
+            dict["%chain-cumdiff%"] = std::to_string(chain->cumDifficulty());
             dict["%mining-status%"] = (_miningDone ? "stopped" : "started");
             dict["%mining-uuid%"] = _uuid;
 
@@ -208,19 +267,20 @@ void MinerApp::initRestService()
             auto result =
                     std::from_chars(indexStr.data(), indexStr.data() + indexStr.size(), index);
 
+            const auto chain = chainSnapshot();
             std::stringstream ss;
-            if (result.ec != std::errc() || index >= _blockchain->size())
+            if (result.ec != std::errc() || index >= chain->size())
             {
                 ss << R"xx(<html><body><h2 stye="color:red">Invalid Block</h2></body></html>)xx";
             }
             else
             {
-                nl::json json = _blockchain->at(index);
+                nl::json json = *(chain->fullBlock(index));
                 ss << "<pre>" << json.dump(4) << "</pre>";
                 ss << "<br/>";
                 if (index > 0) ss << "<a href='/block-idx/" << (index - 1) << "'>prev</a>&nbsp;";
                 ss << "current: " << index;
-                if (index < _blockchain->size()) ss << "&nbsp;<a href='/block-idx/" << (index + 1) << "'>next</a>&nbsp;";
+                if (index < chain->size()) ss << "&nbsp;<a href='/block-idx/" << (index + 1) << "'>next</a>&nbsp;";
             }
 
             response->write(ss);
@@ -242,20 +302,21 @@ void MinerApp::initRestService()
                 return;
             }
 
+            const auto chain = chainSnapshot();
             nl::json json;
 
-            if (startingIdx >= _blockchain->size())
+            if (startingIdx >= chain->size())
             {
                 startingIdx = 0;
             }
             else
             {
-                startingIdx = _blockchain->size() - startingIdx;
+                startingIdx = chain->size() - startingIdx;
             }
 
-            for (auto idx = startingIdx; idx < _blockchain->size(); idx++)
+            for (auto idx = startingIdx; idx < chain->size(); idx++)
             {
-                json["blocks"].push_back(_blockchain->at(idx));
+                json["blocks"].push_back(*(chain->fullBlock(idx)));
             }
             response->write(json.dump());
         };
@@ -371,9 +432,10 @@ void MinerApp::initRestService()
     _httpServer.resource["^/rest/summary$"]["GET"] = 
         [this](std::shared_ptr<HttpResponse> response, std::shared_ptr<HttpRequest> request)
         {
+            const auto chain = chainSnapshot();
             nl::json jresponse;
-            jresponse["blocks"].push_back(_blockchain->back());
-            jresponse["cumdiff"] = _blockchain->cumDifficulty();
+            jresponse["blocks"].push_back(*(chain->fullBlock(chain->size() - 1)));
+            jresponse["cumdiff"] = chain->cumDifficulty();
             jresponse["difficulty"] = _miner.difficulty();
             jresponse["mining"] = !this->_miningDone;
             response->write(jresponse.dump());
@@ -394,41 +456,92 @@ void MinerApp::initRestService()
                 return;
             }
 
-            // ok NOW let's lock
-            std::lock_guard<std::mutex> lock{_chainMutex};
-
-            if (blockIndex >= _blockchain->size())
+            const auto chain = chainSnapshot();
+            if (blockIndex >= chain->size())
             {
                 response->write(SimpleWeb::StatusCode::client_error_bad_request);
                 return;
             }
 
-            const auto& block = ash::GetBlockDetails(*_blockchain, blockIndex);
+            const auto& block = ash::GetBlockDetails(*chain, blockIndex);
             assert(block.index() == blockIndex);
 
             nl::json json = block;
+            if (!block.hasTransactions())
+            {
+                // the block is marked as pruned by its encoding
+                json["prunedblocks"] = { 0, _database->prunedHeight() - 1 };
+            }
+
             auto indent = ash::GetIndent(request->parse_query_string());
             response->write(json.dump(indent));
             return;
         };
 
+    // returns the inclusion proof of a transaction in a block, which
+    // can be checked against the block's Merkle root
+    _httpServer.resource[R"x(^/rest/merkleproof/([0-9]+)/([0-9]+)$)x"]["GET"] =
+        [this](std::shared_ptr<HttpResponse> response, std::shared_ptr<HttpRequest> request) 
+        {
+            std::uint64_t blockIndex = 0u;
+            std::uint64_t txIndex = 0u;
+            const auto blockStr = request->path_match[1].str();
+            const auto txStr = request->path_match[2].str();
+
+            auto blockResult = 
+                std::from_chars(blockStr.data(), blockStr.data() + blockStr.size(), blockIndex);
+            auto txResult = 
+                std::from_chars(txStr.data(), txStr.data() + txStr.size(), txIndex);
+
+            if (blockResult.ec != std::errc{} || txResult.ec != std::errc{})
+            {
+                response->write(SimpleWeb::StatusCode::client_error_bad_request);
+                return;
+            }
+
+            const auto chain = chainSnapshot();
+            if (blockIndex >= chain->size())
+            {
+                response->write(SimpleWeb::StatusCode::client_error_bad_request);
+                return;
+            }
+
+            const auto blockptr = chain->fullBlock(blockIndex);
+            const auto& block = *blockptr;
+            const auto& txs = block.transactions();
+            if (txIndex >= txs.size())
+            {
+                response->write(SimpleWeb::StatusCode::client_error_bad_request);
+                return;
+            }
+
+            nl::json json;
+            json["block"] = blockIndex;
+            json["txid"] = txs.at(txIndex).id();
+            json["merkleroot"] = block.merkleRoot();
+            json["proof"] = ash::GetMerkleProof(txs, txIndex);
+
+            auto indent = ash::GetIndent(request->parse_query_string());
+            response->write(json.dump(indent));
+        };
+
     // returns a list of unspent txouts for either the entire chain or
     // a specific address
     _httpServer.resource[R"x(^/rest/unspent(?:/+|(?:/([0-9a-zA-Z]+)))?$)x"]["GET"] = 
         [this](std::shared_ptr<HttpResponse> response, std::shared_ptr<HttpRequest> request) 
         {
-            std::lock_guard<std::mutex> lock{ _chainMutex };
+            const auto chain = chainSnapshot();
             nl::json json;
 
             if (request->path_match.size() > 1
                 && request->path_match[1].str().size() > 0)
             {
                 
-                json = ash::GetUnspentTxOuts(*_blockchain, request->path_match[1].str());
+                json = ash::GetUnspentTxOuts(*chain, request->path_match[1].str());
             }
             else
             {
-                json = ash::GetUnspentTxOuts(*_blockchain);
+                json = ash::GetUnspentTxOuts(*chain);
             }
 
             auto ident = ash::GetIndent(request->parse_query_string());
@@ -441,8 +554,8 @@ void MinerApp::initRestService()
         {
             const auto address = request->path_match[1].str();
 
-            std::lock_guard<std::mutex> lock{ _chainMutex };
-            nl::json json = ash::GetAddressLedger(*_blockchain, address);
+            const auto chain = chainSnapshot();
+            nl::json json = chain->addressLedger(address);
 
             auto indent = ash::GetIndent(request->parse_query_string());
             response->write(json.dump(indent));
@@ -454,12 +567,12 @@ void MinerApp::initRestService()
         {
             const auto transaction = request->path_match[1].str();
 
-            std::lock_guard<std::mutex> lock{ _chainMutex };
-            auto txpt = ash::FindTransaction(*_blockchain, transaction);
+            const auto chain = chainSnapshot();
+            auto txpt = ash::FindTransaction(*chain, *_database, transaction);
             if (txpt.has_value())
             {
                 auto [blockindex, txindex] = *txpt;
-                auto tempblock = ash::GetBlockDetails(*_blockchain, blockindex);
+                auto tempblock = ash::GetBlockDetails(*chain, blockindex);
                 nl::json json = tempblock.transactions().at(txindex);
 
                 // add some more info about the block itself so we don't have to look it up
@@ -468,7 +581,9 @@ void MinerApp::initRestService()
 
                 auto indent = ash::GetIndent(request->parse_query_string());
                 response->write(json.dump(indent));
+                return;
             }
+
             response->write(SimpleWeb::StatusCode::client_error_not_found);
         };
 }
@@ -494,7 +609,7 @@ void MinerApp::initHttp()
     _httpServer.resource[R"x(^/block/([0-9,]+)(?:\/(json)){0,1})x"]["GET"] = 
         [this](std::shared_ptr<HttpResponse> response, std::shared_ptr<HttpRequest> request) 
         {
-            std::lock_guard<std::mutex> lock{_chainMutex};
+            const auto chain = chainSnapshot();
             std::uint64_t blockIndex = 0u;
             bool json = false;
 
@@ -503,13 +618,14 @@ void MinerApp::initHttp()
                 std::from_chars(indexStr.data(), indexStr.data() + indexStr.size(), blockIndex);
 
             if (result.ec == std::errc::invalid_argument
-                || blockIndex >= _blockchain->size())
+                || blockIndex >= chain->size())
             {
                 response->write(SimpleWeb::StatusCode::client_error_bad_request);
                 return;
             }
 
-            const auto& block = _blockchain->at(blockIndex);
+            const auto blockptr = chain->fullBlock(blockIndex);
+            const auto& block = *blockptr;
             assert(block.index() == blockIndex);
 
             if (request->path_match.size() > 2 
@@ -525,7 +641,7 @@ void MinerApp::initHttp()
             dict["%block-id%"] = std::to_string(blockIndex);
             dict["%block-hash%"] = block.hash();
             dict["%block-previoushash%"] = block.previousHash();
-            dict["%block-root%"] = "TODO: MERKLE ROOT";
+            dict["%block-root%"] = block.merkleRoot();
             dict["%block-time%"] = "TODO: BLOCK TIME";
             dict["%block-difficulty%"] = std::to_string(block.difficulty());
             dict["%block-nonce%"] = std::to_string(block.nonce());
@@ -534,9 +650,9 @@ void MinerApp::initHttp()
             dict["%block-previd%"] = "TODO: VALUE OUT";
 
             dict["%block-previd%"] = std::to_string(blockIndex - 1);
-            if (blockIndex == 0) dict["%block-previd%"] = std::to_string(_blockchain->size() - 1);
+            if (blockIndex == 0) dict["%block-previd%"] = std::to_string(chain->size() - 1);
 
-            auto nextId = (blockIndex + 1) % _blockchain->size();
+            auto nextId = (blockIndex + 1) % chain->size();
             dict["%block-nextid%"] = std::to_string(nextId);
 
             this->servePage(response, "block.html", block_html, dict);
@@ -655,7 +771,9 @@ void MinerApp::run()
 
     // maybe it's ok if the blockchain has some concept of
     // a persistence object?
+    configureHeadersOnly();
     _database->initialize(*_blockchain, genesisBlockCallback);
+    publishChainSnapshot();
 
     _httpThread = std::thread(
         [this]()
@@ -731,19 +849,33 @@ void MinerApp::runMineThread()
             continue;
         }
 
-        // TODO: need better locking/syncing on the chain from 
-        //       point on
-
-        // append the block to the chain
-        if (!_blockchain->addNewBlock(*newblock))
         {
-            _logger->error("could not add new block #{} to blockchain, stopping mining", newblock->index());
-            _miningDone = true;
-            break;
-        }
+            std::lock_guard<std::mutex> lock{_chainMutex};
 
-        // write the block to the database
-        _database->write(*newblock);
+            // append the block to the chain
+            if (!_blockchain->addNewBlock(*newblock))
+            {
+                _logger->error("could not add new block #{} to blockchain, stopping mining", newblock->index());
+                _miningDone = true;
+                break;
+            }
+
+            // write the block to the database
+            try
+            {
+                _database->write(*newblock);
+                _database->checkpoint(*_blockchain);
+            }
+            catch (const std::exception& ex)
+            {
+                _logger->error("could not write block #{} to the database, stopping mining: {}",
+                    newblock->index(), ex.what());
+                _miningDone = true;
+                break;
+            }
+
+            publishChainSnapshot();
+        }
 
         // see if there's an update waiting for the local
         // copy of the chain
@@ -762,7 +894,7 @@ void MinerApp::broadcastNewBlock(const Block& block)
     nl::json msg;
     msg["message"] = "newblock";
     msg["message-type"] = "request";
-    msg["block"] = _blockchain->back();
+    msg["block"] = *(_blockchain->fullBlock(_blockchain->size() - 1));
     msg["cumdiff"] = _blockchain->cumDifficulty();
     _peers.broadcast(msg.dump());
 }
@@ -777,51 +909,99 @@ bool MinerApp::syncBlockchain()
     if (std::lock_guard<std::mutex> lock{_chainMutex}; 
         _tempchain)
     {
-        if (_tempchain->front().index() == 0)
-        {
-            // we're replacing the full chain
-            _blockchain.swap(_tempchain);
-            _database->reset();
-            _database->writeChain(*_blockchain);
-            retval = true;
-        }
-        else if (_tempchain->front().index() <= _blockchain->back().index())
+        try
         {
-            auto startIdx = _tempchain->front().index();
-            _blockchain->resize(startIdx);
-            for (const auto& block : *_tempchain)
+            if (_tempchain->front().index() == 0)
             {
-                // add up until a point of failure (if there
-                // is one)
-                if (!_blockchain->addNewBlock(block))
+                // we're replacing the full chain
+                _blockchain.swap(_tempchain);
+                _database->replaceChain(*_blockchain);
+                configureHeadersOnly();
+                retval = true;
+            }
+            else if (_tempchain->front().index() <= _blockchain->back().index())
+            {
+                auto startIdx = _tempchain->front().index();
+                if (startIdx < _database->prunedHeight())
                 {
-                    _logger->warn("failed to add block while updating chain at index");
+                    _logger->warn("cannot roll back to block #{}, the blocks before #{} are pruned",
+                        startIdx, _database->prunedHeight());
+
+                    _tempchain.reset();
+                    return false;
                 }
-            }
 
-            _database->reset();
-            _database->writeChain(*_blockchain);
-            retval = true;
-        }
-        else if (_tempchain->front().index() == _blockchain->back().index() + 1)
-        {
-            for (const auto& block : *_tempchain)
-            {
-                if (_blockchain->addNewBlock(block))
+                // the replacement blocks are added to a copy of the chain 
+                // first, so a block that does not fit leaves the local tail
+                // alone. The removed blocks may be read back from the 
+                // database while the copy is resized, so it is truncated
+                // afterwards.
+                auto rolledBack = *_blockchain;
+                rolledBack.resize(startIdx);
+
+                auto updated = rolledBack;
+                const auto rejected = std::find_if(_tempchain->begin(), _tempchain->end(),
+                    [&updated](const Block& block)
+                    {
+                        return !updated.addNewBlock(block);
+                    });
+
+                if (rejected != _tempchain->end())
+                {
+                    _logger->warn("refusing the update of the local chain from block #{}, block #{} is not valid",
+                        startIdx, rejected->index());
+
+                    _tempchain.reset();
+                    return false;
+                }
+
+                *_blockchain = std::move(updated);
+                retval = true;
+
+                _database->truncateTo(rolledBack);
+                for (const auto& block : *_tempchain)
                 {
                     _database->write(block);
                 }
             }
-            retval = true;
+            else if (_tempchain->front().index() == _blockchain->back().index() + 1)
+            {
+                for (const auto& block : *_tempchain)
+                {
+                    if (_blockchain->addNewBlock(block))
+                    {
+                        _database->write(block);
+                    }
+                }
+                retval = true;
+            }
+            else
+            {
+                _logger->warn("temp chain is too far ahead with blocks {}-{} and local chain {}-{}",
+                    _tempchain->front().index(), _tempchain->back().index(),
+                    _blockchain->front().index(), _blockchain->back().index());
+            }
+
+            if (retval)
+            {
+                _database->checkpoint(*_blockchain);
+            }
         }
-        else
+        catch (const std::exception& ex)
         {
-            _logger->warn("temp chain is too far ahead with blocks {}-{} and local chain {}-{}",
-                _tempchain->front().index(), _tempchain->back().index(),
-                _blockchain->front().index(), _blockchain->back().index());
+            // like a failed write of a mined block, the chain in memory
+            // is ahead of the database until the node is restarted
+            _logger->error("could not write the synced blocks to the database, stopping mining: {}", ex.what());
+            _miningDone = true;
+            publishChainSnapshot();
         }
 
         _tempchain.reset();
+
+        if (retval)
+        {
+            publishChainSnapshot();
+        }
     }
     
     return retval;
@@ -835,15 +1015,26 @@ void MinerApp::dispatchRequest(HcConnectionPtr connection, const nl::json& json)
     nl::json jresponse;
     if (message == "summary")
     {
-        jresponse["blocks"].push_back(_blockchain->front());
-        jresponse["blocks"].push_back(_blockchain->back());
-        jresponse["cumdiff"] = _blockchain->cumDifficulty();
+        const auto chain = chainSnapshot();
+        jresponse["blocks"].push_back(*(chain->fullBlock(0)));
+        jresponse["blocks"].push_back(*(chain->fullBlock(chain->size() - 1)));
+        jresponse["cumdiff"] = chain->cumDifficulty();
     }
     else if (message == "chain")
     {
-        if (!json.contains("id1") && !json.contains("id2"))
+        const auto chain = chainSnapshot();
+        const auto prunedHeight = _database->prunedHeight();
+        if (prunedHeight > 0
+            && (!json.contains("id1") 
+                || (json["id1"].is_number() && json["id1"].get<std::uint64_t>() < prunedHeight)))
         {
-            jresponse["blocks"] = *(this->_blockchain);
+            // the transactions of pruned blocks cannot be sent
+            jresponse["error"] = fmt::format("blocks #0-#{} are pruned", prunedHeight - 1);
+            jresponse["prunedblocks"] = { 0, prunedHeight - 1 };
+        }
+        else if (!json.contains("id1") && !json.contains("id2"))
+        {
+            jresponse["blocks"] = *chain;
         }
         else if (!json["id1"].is_number())
         {
@@ -858,22 +1049,22 @@ void MinerApp::dispatchRequest(HcConnectionPtr connection, const nl::json& json)
             auto id1 = json["id1"].get<std::uint64_t>();
             auto id2 = json["id2"].get<std::uint64_t>();
 
-            auto startIt = std::find_if(_blockchain->begin(), _blockchain->end(),
+            auto startIt = std::find_if(chain->begin(), chain->end(),
                 [id1](const Block& block)
                 {
                     return block.index() == id1;
                 });
 
-            if (startIt == _blockchain->end())
+            if (startIt == chain->end())
             {
                 jresponse["error"] = "could not find id1 in chain";
             }
             else
             {
                 for (auto currentIt = startIt; 
-                    currentIt != _blockchain->end() && currentIt->index() <= id2; currentIt++)
+                    currentIt != chain->end() && currentIt->index() <= id2; currentIt++)
                 {
-                    jresponse["blocks"].push_back(*currentIt);
+                    jresponse["blocks"].push_back(*(chain->fullBlock(currentIt - chain->begin())));
                 }
             }
         }
@@ -986,8 +1177,13 @@ void MinerApp::handleResponse(HcConnectionPtr connection, const nl::json& json)
     }
     else if (message == "chain")
     {
-        if (const auto tempchain = json["blocks"].get<ash::Blockchain>();
-                tempchain.size() <= 0 || !tempchain.isValidChain())
+        if (json.contains("error"))
+        {
+            _logger->warn("wsc:/chain 'chain' request failed on connection {}: {}", 
+                static_cast<void*>(connection.get()), json["error"].get<std::string>());
+        }
+        else if (const auto tempchain = json["blocks"].get<ash::Blockchain>();
+                !ash::IsValidPeerChain(tempchain))
         {
             _logger->info("received invalid chain from connection {}", 
                 static_cast<void*>(connection.get()));
@@ -1009,7 +1205,12 @@ void MinerApp::handleResponse(HcConnectionPtr connection, const nl::json& json)
 
 void MinerApp::handleChainResponse(HcConnectionPtr connection, const Blockchain& tempchain)
 {
-    if (tempchain.front().index() == 0)
+    if (!ash::IsValidPeerChain(tempchain))
+    {
+        _logger->info("refusing invalid or pruned chain from connection {}", 
+            static_cast<void*>(connection.get()));
+    }
+    else if (tempchain.front().index() == 0)
     {
         _logger->info("queuing replacement for local chain with with blocks {}-{}",
             tempchain.front().index(), tempchain.back().index());
@@ -70,6 +70,20 @@ private:
     void initWebSocket();
     void initPeers();
 
+    using ChainSnapshot = std::shared_ptr<const Blockchain>;
+
+    // readers take an immutable copy of the chain so they never
+    // wait on `_chainMutex`
+    ChainSnapshot chainSnapshot() const;
+
+    // replaces the readers' copy of the chain, called by the writer
+    // while it holds `_chainMutex` after it changes the chain
+    void publishChainSnapshot();
+
+    // with `database.headersonly` the chain only keeps the block
+    // headers in memory and loads the transactions from the database
+    void configureHeadersOnly();
+
     void runMineThread();
     [[maybe_unused]] bool syncBlockchain();
     void broadcastNewBlock(const Block& block);
@@ -97,6 +111,9 @@ private:
     BlockChainPtr           _blockchain;
     BlockChainPtr           _tempchain;
 
+    mutable std::mutex      _snapshotMutex; // only guards swapping `_snapshot`
+    ChainSnapshot           _snapshot;      // published copy of `_blockchain`
+
     SettingsPtr             _settings;
     PeerManager             _peers;
 
@@ -0,0 +1,380 @@
+#include <algorithm>
+#include <cassert>
+
+#include "SHA256Kernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ASH_SHA256_X86 1
+#endif
+
+#ifdef ASH_SHA256_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ASH_TARGET(x)
+#else
+#include <cpuid.h>
+#define ASH_TARGET(x) __attribute__((target(x)))
+#endif
+#include <immintrin.h>
+#endif
+
+namespace ash
+{
+
+namespace crypto
+{
+
+namespace
+{
+
+alignas(16) constexpr std::uint32_t K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline std::uint32_t LoadBE32(const std::uint8_t* ptr)
+{
+    return (static_cast<std::uint32_t>(ptr[0]) << 24)
+        | (static_cast<std::uint32_t>(ptr[1]) << 16)
+        | (static_cast<std::uint32_t>(ptr[2]) << 8)
+        | static_cast<std::uint32_t>(ptr[3]);
+}
+
+inline std::uint32_t RotR(std::uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+//*** portable kernel
+void TransformScalar(SHA256State& state, const std::uint8_t* data, std::size_t blocks)
+{
+    std::uint32_t w[64];
+
+    for (; blocks > 0; blocks--, data += SHA256BlockSize)
+    {
+        for (auto i = 0u; i < 16; i++)
+        {
+            w[i] = LoadBE32(data + (i * 4));
+        }
+
+        for (auto i = 16u; i < 64; i++)
+        {
+            const auto s0 = RotR(w[i - 15], 7) ^ RotR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const auto s1 = RotR(w[i - 2], 17) ^ RotR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (auto i = 0u; i < 64; i++)
+        {
+            const auto t1 = h + (RotR(e, 6) ^ RotR(e, 11) ^ RotR(e, 25))
+                + ((e & f) ^ (~e & g)) + K[i] + w[i];
+            const auto t2 = (RotR(a, 2) ^ RotR(a, 13) ^ RotR(a, 22))
+                + ((a & b) ^ (a & c) ^ (b & c));
+
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+void TransformLanesScalar(SHA256State* states,
+    const std::uint8_t* const* data, std::size_t blocks, std::size_t lanes)
+{
+    for (std::size_t lane = 0; lane < lanes; lane++)
+    {
+        TransformScalar(states[lane], data[lane], blocks);
+    }
+}
+
+#ifdef ASH_SHA256_X86
+
+//*** SHA-NI kernel, one message at a time with the SHA extensions
+ASH_TARGET("sha,sse4.1")
+void TransformShaNi(SHA256State& state, const std::uint8_t* data, std::size_t blocks)
+{
+    const __m128i byteswap =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+    // the SHA instructions want the state as ABEF/CDGH
+    __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0]));
+    __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4]));
+    tmp = _mm_shuffle_epi32(tmp, 0xb1);
+    state1 = _mm_shuffle_epi32(state1, 0x1b);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+    __m128i w[16];
+
+    for (; blocks > 0; blocks--, data += SHA256BlockSize)
+    {
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+
+        for (auto i = 0u; i < 16; i++)
+        {
+            if (i < 4)
+            {
+                w[i] = _mm_shuffle_epi8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + (i * 16))), byteswap);
+            }
+            else
+            {
+                w[i] = _mm_sha256msg2_epu32(
+                    _mm_add_epi32(_mm_sha256msg1_epu32(w[i - 4], w[i - 3]),
+                        _mm_alignr_epi8(w[i - 1], w[i - 2], 4)),
+                    w[i - 1]);
+            }
+
+            __m128i msg = _mm_add_epi32(w[i],
+                _mm_load_si128(reinterpret_cast<const __m128i*>(&K[i * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+
+void TransformLanesShaNi(SHA256State* states,
+    const std::uint8_t* const* data, std::size_t blocks, std::size_t lanes)
+{
+    for (std::size_t lane = 0; lane < lanes; lane++)
+    {
+        TransformShaNi(states[lane], data[lane], blocks);
+    }
+}
+
+//*** AVX2 kernel, eight messages at a time with one message per 32-bit lane
+template<int N>
+ASH_TARGET("avx2")
+inline __m256i RotR8(__m256i x)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N));
+}
+
+ASH_TARGET("avx2")
+inline __m256i Xor3(__m256i a, __m256i b, __m256i c)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(a, b), c);
+}
+
+ASH_TARGET("avx2")
+void Transform8Avx2(SHA256State* states, const std::uint8_t* const* data, std::size_t blocks)
+{
+    __m256i s[8];
+    for (auto j = 0u; j < 8; j++)
+    {
+        s[j] = _mm256_setr_epi32(
+            static_cast<int>(states[0][j]), static_cast<int>(states[1][j]),
+            static_cast<int>(states[2][j]), static_cast<int>(states[3][j]),
+            static_cast<int>(states[4][j]), static_cast<int>(states[5][j]),
+            static_cast<int>(states[6][j]), static_cast<int>(states[7][j]));
+    }
+
+    __m256i w[64];
+
+    for (std::size_t block = 0; block < blocks; block++)
+    {
+        const auto offset = block * SHA256BlockSize;
+
+        for (auto i = 0u; i < 16; i++)
+        {
+            const auto wordOffset = offset + (i * 4);
+            w[i] = _mm256_setr_epi32(
+                static_cast<int>(LoadBE32(data[0] + wordOffset)),
+                static_cast<int>(LoadBE32(data[1] + wordOffset)),
+                static_cast<int>(LoadBE32(data[2] + wordOffset)),
+                static_cast<int>(LoadBE32(data[3] + wordOffset)),
+                static_cast<int>(LoadBE32(data[4] + wordOffset)),
+                static_cast<int>(LoadBE32(data[5] + wordOffset)),
+                static_cast<int>(LoadBE32(data[6] + wordOffset)),
+                static_cast<int>(LoadBE32(data[7] + wordOffset)));
+        }
+
+        for (auto i = 16u; i < 64; i++)
+        {
+            const auto s0 = Xor3(RotR8<7>(w[i - 15]), RotR8<18>(w[i - 15]), _mm256_srli_epi32(w[i - 15], 3));
+            const auto s1 = Xor3(RotR8<17>(w[i - 2]), RotR8<19>(w[i - 2]), _mm256_srli_epi32(w[i - 2], 10));
+            w[i] = _mm256_add_epi32(_mm256_add_epi32(w[i - 16], s0), _mm256_add_epi32(w[i - 7], s1));
+        }
+
+        auto a = s[0], b = s[1], c = s[2], d = s[3];
+        auto e = s[4], f = s[5], g = s[6], h = s[7];
+
+        for (auto i = 0u; i < 64; i++)
+        {
+            const auto ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            const auto maj = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+
+            auto t1 = _mm256_add_epi32(h, Xor3(RotR8<6>(e), RotR8<11>(e), RotR8<25>(e)));
+            t1 = _mm256_add_epi32(t1, ch);
+            t1 = _mm256_add_epi32(t1, _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(K[i])), w[i]));
+            const auto t2 = _mm256_add_epi32(Xor3(RotR8<2>(a), RotR8<13>(a), RotR8<22>(a)), maj);
+
+            h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+            d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+        }
+
+        s[0] = _mm256_add_epi32(s[0], a); s[1] = _mm256_add_epi32(s[1], b);
+        s[2] = _mm256_add_epi32(s[2], c); s[3] = _mm256_add_epi32(s[3], d);
+        s[4] = _mm256_add_epi32(s[4], e); s[5] = _mm256_add_epi32(s[5], f);
+        s[6] = _mm256_add_epi32(s[6], g); s[7] = _mm256_add_epi32(s[7], h);
+    }
+
+    alignas(32) std::uint32_t words[8];
+    for (auto j = 0u; j < 8; j++)
+    {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words), s[j]);
+        for (auto lane = 0u; lane < 8; lane++)
+        {
+            states[lane][j] = words[lane];
+        }
+    }
+}
+
+void TransformLanesAvx2(SHA256State* states,
+    const std::uint8_t* const* data, std::size_t blocks, std::size_t lanes)
+{
+    std::size_t lane = 0;
+    for (; lane + 8 <= lanes; lane += 8)
+    {
+        Transform8Avx2(states + lane, data + lane, blocks);
+    }
+
+    // a partial group is not worth the eight wide kernel
+    for (; lane < lanes; lane++)
+    {
+        TransformScalar(states[lane], data[lane], blocks);
+    }
+}
+
+struct CpuFeatures
+{
+    bool avx2 = false;
+    bool sha = false;
+};
+
+void CpuId(std::uint32_t leaf, std::uint32_t subleaf, std::uint32_t (&regs)[4])
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subleaf));
+    std::copy(std::begin(info), std::end(info), std::begin(regs));
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// whether the OS saves the YMM registers on a context switch
+bool OSSupportsAvx()
+{
+#ifdef _MSC_VER
+    const auto xcr0 = _xgetbv(0);
+#else
+    std::uint32_t eax = 0;
+    std::uint32_t edx = 0;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    const std::uint64_t xcr0 = (static_cast<std::uint64_t>(edx) << 32) | eax;
+#endif
+    return (xcr0 & 0x6) == 0x6;
+}
+
+CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features;
+
+    std::uint32_t regs[4];
+    CpuId(0, 0, regs);
+    if (regs[0] < 7)
+    {
+        return features;
+    }
+
+    CpuId(1, 0, regs);
+    const bool ssse3 = (regs[2] & (1u << 9)) != 0;
+    const bool sse41 = (regs[2] & (1u << 19)) != 0;
+    const bool osxsave = (regs[2] & (1u << 27)) != 0;
+    const bool avx = (regs[2] & (1u << 28)) != 0;
+
+    CpuId(7, 0, regs);
+    features.avx2 = avx && osxsave && (regs[1] & (1u << 5)) != 0 && OSSupportsAvx();
+    features.sha = ssse3 && sse41 && (regs[1] & (1u << 29)) != 0;
+
+    return features;
+}
+
+#endif // ASH_SHA256_X86
+
+constexpr SHA256Kernel ScalarKernel{ "scalar", 1, &TransformScalar, &TransformLanesScalar };
+
+#ifdef ASH_SHA256_X86
+constexpr SHA256Kernel ShaNiKernel{ "sha-ni", 1, &TransformShaNi, &TransformLanesShaNi };
+constexpr SHA256Kernel Avx2Kernel{ "avx2", 8, &TransformScalar, &TransformLanesAvx2 };
+#endif
+
+} // namespace
+
+std::vector<const SHA256Kernel*> GetSupportedSHA256Kernels()
+{
+    std::vector<const SHA256Kernel*> retval{ &ScalarKernel };
+
+#ifdef ASH_SHA256_X86
+    static const auto features = DetectCpuFeatures();
+    if (features.avx2)
+    {
+        retval.push_back(&Avx2Kernel);
+    }
+
+    if (features.sha)
+    {
+        retval.push_back(&ShaNiKernel);
+    }
+#endif
+
+    assert(retval.back()->lanes <= SHA256MaxLanes);
+    return retval;
+}
+
+const SHA256Kernel& GetSHA256Kernel()
+{
+    static const SHA256Kernel& kernel = *(GetSupportedSHA256Kernels().back());
+    return kernel;
+}
+
+void SHA256StateToDigest(const SHA256State& state, std::uint8_t* digest)
+{
+    for (const auto word : state)
+    {
+        *digest++ = static_cast<std::uint8_t>(word >> 24);
+        *digest++ = static_cast<std::uint8_t>(word >> 16);
+        *digest++ = static_cast<std::uint8_t>(word >> 8);
+        *digest++ = static_cast<std::uint8_t>(word);
+    }
+}
+
+} // namespace ash::crypto
+
+} // namespace ash
@@ -0,0 +1,56 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace ash
+{
+
+namespace crypto
+{
+
+constexpr std::size_t SHA256BlockSize = 64;
+constexpr std::size_t SHA256DigestSize = 32;
+
+// the most messages any kernel hashes at once
+constexpr std::size_t SHA256MaxLanes = 8;
+
+using SHA256State = std::array<std::uint32_t, 8>;
+
+constexpr SHA256State SHA256InitialState =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+//! A SHA-256 compression function. `transform` compresses `blocks`
+//  64-byte blocks into a single state, `transformLanes` does the same
+//  for `lanes` independent messages of the same length, which is where
+//  the SIMD kernels hash several messages at once. Padding is left to
+//  the caller.
+struct SHA256Kernel
+{
+    std::string_view    name;
+    std::size_t         lanes; // messages the kernel prefers to hash at once
+
+    void (*transform)(SHA256State& state,
+        const std::uint8_t* data, std::size_t blocks);
+
+    void (*transformLanes)(SHA256State* states,
+        const std::uint8_t* const* data, std::size_t blocks, std::size_t lanes);
+};
+
+// the fastest kernel this CPU supports, selected once with CPUID
+const SHA256Kernel& GetSHA256Kernel();
+
+// every kernel this CPU supports, the portable scalar kernel is
+// always first and the preferred kernel is last
+std::vector<const SHA256Kernel*> GetSupportedSHA256Kernels();
+
+// writes the big-endian digest of a finalized state
+void SHA256StateToDigest(const SHA256State& state, std::uint8_t* digest);
+
+} // namespace ash::crypto
+
+} // namespace ash
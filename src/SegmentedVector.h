@@ -0,0 +1,304 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "AshUtils.h"
+
+namespace ash
+{
+
+//! A sequence stored in fixed size segments so appending never moves
+//  the existing elements, references and pointers to an element stay
+//  valid until that element is removed or changed while a copy shares
+//  it. Copies share their segments, so a copy costs one pointer per 
+//  segment and a segment is only copied when it is changed while it is
+//  shared. A copy can be read on one thread while the vector it was 
+//  copied from is changed on another.
+template<typename T, std::size_t SegmentSize = 256>
+class SegmentedVector final
+{
+    static_assert(SegmentSize > 0);
+
+    // a segment has room for `SegmentSize` elements up front and never
+    // grows past that, so its elements never move. The copies sharing a
+    // segment each see the elements up to their own size, the one that
+    // claims the next slot may append in place.
+    struct Segment
+    {
+        std::atomic<std::size_t>    count = 0;  // the constructed elements
+        alignas(T) std::byte        storage[sizeof(T) * SegmentSize];
+
+        Segment() {}
+
+        ~Segment()
+        {
+            destroy(0, count.load());
+        }
+
+        Segment(const Segment&) = delete;
+        Segment& operator=(const Segment&) = delete;
+
+        // the memory of the element at `index`, which may not be constructed
+        void* slot(std::size_t index) { return storage + index * sizeof(T); }
+
+        T& item(std::size_t index) { return *std::launder(reinterpret_cast<T*>(slot(index))); }
+        const T& item(std::size_t index) const 
+        { 
+            return *std::launder(reinterpret_cast<const T*>(storage + index * sizeof(T))); 
+        }
+
+        void destroy(std::size_t first, std::size_t last)
+        {
+            for (auto idx = first; idx < last; idx++)
+            {
+                std::destroy_at(&item(idx));
+            }
+        }
+    };
+
+    using SegmentPtr = std::shared_ptr<Segment>;
+
+    std::vector<SegmentPtr> _segments;
+    std::size_t             _size = 0;
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = T&;
+    using const_reference = const T&;
+
+    class const_iterator
+    {
+        const SegmentedVector*  _container = nullptr;
+        std::size_t             _index = 0;
+
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        const_iterator(const SegmentedVector* container, std::size_t index)
+            : _container{container}, _index{index}
+        {
+        }
+
+        reference operator*() const { return (*_container)[_index]; }
+        pointer operator->() const { return &(*_container)[_index]; }
+        reference operator[](difference_type n) const { return (*_container)[_index + n]; }
+
+        const_iterator& operator++() { ++_index; return *this; }
+        const_iterator operator++(int) { auto temp = *this; ++_index; return temp; }
+        const_iterator& operator--() { --_index; return *this; }
+        const_iterator operator--(int) { auto temp = *this; --_index; return temp; }
+
+        const_iterator& operator+=(difference_type n) { _index += n; return *this; }
+        const_iterator& operator-=(difference_type n) { _index -= n; return *this; }
+
+        friend const_iterator operator+(const_iterator it, difference_type n) { return it += n; }
+        friend const_iterator operator+(difference_type n, const_iterator it) { return it += n; }
+        friend const_iterator operator-(const_iterator it, difference_type n) { return it -= n; }
+
+        friend difference_type operator-(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return static_cast<difference_type>(lhs._index) - static_cast<difference_type>(rhs._index);
+        }
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs._container == rhs._container && lhs._index == rhs._index;
+        }
+
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs) { return !(lhs == rhs); }
+        friend bool operator<(const const_iterator& lhs, const const_iterator& rhs) { return lhs._index < rhs._index; }
+        friend bool operator>(const const_iterator& lhs, const const_iterator& rhs) { return rhs < lhs; }
+        friend bool operator<=(const const_iterator& lhs, const const_iterator& rhs) { return !(rhs < lhs); }
+        friend bool operator>=(const const_iterator& lhs, const const_iterator& rhs) { return !(lhs < rhs); }
+    };
+
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    SegmentedVector() = default;
+    SegmentedVector(const SegmentedVector&) = default;
+    SegmentedVector& operator=(const SegmentedVector&) = default;
+
+    SegmentedVector(SegmentedVector&& other) noexcept
+        : _segments{ std::move(other._segments) },
+          _size{ std::exchange(other._size, 0) }
+    {
+        other._segments.clear();
+    }
+
+    SegmentedVector& operator=(SegmentedVector&& other) noexcept
+    {
+        if (this != &other)
+        {
+            _segments = std::move(other._segments);
+            _size = std::exchange(other._size, 0);
+            other._segments.clear();
+        }
+
+        return *this;
+    }
+
+    std::size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+
+    const_iterator begin() const { return const_iterator{this, 0}; }
+    const_iterator end() const { return const_iterator{this, _size}; }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator{end()}; }
+    const_reverse_iterator rend() const { return const_reverse_iterator{begin()}; }
+
+    // the non-const accessors copy the element's segment first when 
+    // a copy of the vector shares it
+    T& operator[](std::size_t index)
+    {
+        return own(index / SegmentSize).item(index % SegmentSize);
+    }
+
+    const T& operator[](std::size_t index) const
+    {
+        return _segments[index / SegmentSize]->item(index % SegmentSize);
+    }
+
+    T& at(std::size_t index)
+    {
+        checkIndex(index);
+        return (*this)[index];
+    }
+
+    const T& at(std::size_t index) const
+    {
+        checkIndex(index);
+        return (*this)[index];
+    }
+
+    T& front() { return (*this)[0]; }
+    const T& front() const { return (*this)[0]; }
+    T& back() { return (*this)[_size - 1]; }
+    const T& back() const { return (*this)[_size - 1]; }
+
+    void push_back(const T& item)
+    {
+        emplace_back(item);
+    }
+
+    void push_back(T&& item)
+    {
+        emplace_back(std::move(item));
+    }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        const auto offset = _size % SegmentSize;
+        if (offset == 0)
+        {
+            _segments.push_back(std::make_shared<Segment>());
+        }
+
+        // the slot after the last element is free unless a copy that 
+        // shares the segment appended to it or an element was left there
+        Segment* segment = _segments.back().get();
+        auto expected = offset;
+        if (!segment->count.compare_exchange_strong(expected, offset + 1))
+        {
+            segment = &own(_segments.size() - 1);
+            segment->count = offset + 1;
+        }
+
+        T* item = nullptr;
+        try
+        {
+            item = new (segment->slot(offset)) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            // no copy can have claimed a slot past the one that failed
+            segment->count = offset;
+            throw;
+        }
+
+        _size++;
+        return *item;
+    }
+
+    void pop_back()
+    {
+        _size--;
+        const auto offset = _size % SegmentSize;
+        if (offset == 0)
+        {
+            _segments.pop_back();
+        }
+        else if (utils::IsSoleOwner(_segments.back()))
+        {
+            trim(*_segments.back(), offset);
+        }
+
+        // a shared segment keeps the element for the copies that see it
+    }
+
+    void clear() noexcept
+    {
+        _segments.clear();
+        _size = 0;
+    }
+
+private:
+    void checkIndex(std::size_t index) const
+    {
+        if (index >= _size)
+        {
+            throw std::out_of_range(fmt::format("index {} is out of range for size {}", index, _size));
+        }
+    }
+
+    static void trim(Segment& segment, std::size_t count)
+    {
+        const auto constructed = segment.count.load();
+        if (constructed > count)
+        {
+            segment.destroy(count, constructed);
+            segment.count = count;
+        }
+    }
+
+    // the segment with only the elements of this vector, which is 
+    // copied when another vector shares it
+    Segment& own(std::size_t index)
+    {
+        auto& segment = _segments[index];
+        const auto used = std::min(SegmentSize, _size - index * SegmentSize);
+        if (utils::IsSoleOwner(segment))
+        {
+            trim(*segment, used);
+            return *segment;
+        }
+
+        auto copy = std::make_shared<Segment>();
+        for (std::size_t idx = 0; idx < used; idx++)
+        {
+            new (copy->slot(idx)) T(std::as_const(*segment).item(idx));
+            copy->count = idx + 1;
+        }
+
+        segment = std::move(copy);
+        return *segment;
+    }
+};
+
+} // namespace ash
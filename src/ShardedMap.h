@@ -0,0 +1,223 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include "AshUtils.h"
+
+namespace ash
+{
+
+//! An unordered map split into shards by the hash of the key. Copies
+//  share their shards and the shards share their values, so a copy
+//  costs one pointer per shard. The first change to a shard after a
+//  copy copies the shard's pointers to its values, about size() /
+//  ShardCount of them, and the value that is changed, the other values
+//  stay shared. A copy can be read on one thread while the map it was
+//  copied from is changed on another.
+template<typename Key, typename Value, typename Hash = std::hash<Key>, std::size_t ShardCount = 256>
+class ShardedMap final
+{
+    static_assert(ShardCount > 0);
+
+    using ValuePtr = std::shared_ptr<Value>;
+    using Shard = std::unordered_map<Key, ValuePtr, Hash>;
+    using ShardPtr = std::shared_ptr<Shard>;
+
+    std::array<ShardPtr, ShardCount>    _shards;    // a shard is created when it is first used
+    std::size_t                         _size = 0;
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+
+    class const_iterator
+    {
+        const ShardedMap*                   _container = nullptr;
+        std::size_t                         _shard = ShardCount;
+        typename Shard::const_iterator      _it;
+
+        // moves to the first entry of the next shard that has one
+        void skipEmpty()
+        {
+            while (_shard < ShardCount
+                && (!_container->_shards[_shard] || _it == _container->_shards[_shard]->end()))
+            {
+                if (++_shard < ShardCount && _container->_shards[_shard])
+                {
+                    _it = _container->_shards[_shard]->begin();
+                }
+            }
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = ShardedMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+
+        // the entries only hold pointers to their values, so the key and
+        // the value are handed out as a pair of references
+        using reference = std::pair<const Key&, const Value&>;
+
+        const_iterator() = default;
+
+        const_iterator(const ShardedMap* container, std::size_t shard)
+            : _container{container}, _shard{shard}
+        {
+            if (_shard < ShardCount && _container->_shards[_shard])
+            {
+                _it = _container->_shards[_shard]->begin();
+            }
+
+            skipEmpty();
+        }
+
+        reference operator*() const { return reference{ _it->first, *(_it->second) }; }
+
+        const_iterator& operator++() { ++_it; skipEmpty(); return *this; }
+        const_iterator operator++(int) { auto temp = *this; ++(*this); return temp; }
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs._shard == rhs._shard
+                && (lhs._shard == ShardCount || lhs._it == rhs._it);
+        }
+
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs) { return !(lhs == rhs); }
+    };
+
+    std::size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+
+    const_iterator begin() const { return const_iterator{this, 0}; }
+    const_iterator end() const { return const_iterator{this, ShardCount}; }
+
+    // returns nullptr when the key is not in the map
+    const Value* find(const Key& key) const
+    {
+        const auto& shard = _shards[shardOf(key)];
+        if (!shard)
+        {
+            return nullptr;
+        }
+
+        auto it = shard->find(key);
+        return it != shard->end() ? it->second.get() : nullptr;
+    }
+
+    // like `find()` for a value that is changed, which copies the key's
+    // shard and the value first when a copy of the map shares them
+    Value* modify(const Key& key)
+    {
+        if (!find(key))
+        {
+            return nullptr;
+        }
+
+        return &own(own(shardOf(key)).at(key));
+    }
+
+    Value& operator[](const Key& key)
+    {
+        auto& shard = own(shardOf(key));
+        auto [it, inserted] = shard.try_emplace(key);
+        if (inserted)
+        {
+            it->second = std::make_shared<Value>();
+            _size++;
+        }
+
+        return own(it->second);
+    }
+
+    // false when the key is already in the map, which is not changed
+    bool emplace(const Key& key, Value value)
+    {
+        if (find(key))
+        {
+            return false;
+        }
+
+        own(shardOf(key)).emplace(key, std::make_shared<Value>(std::move(value)));
+        _size++;
+        return true;
+    }
+
+    // removes the key and returns its value
+    std::optional<Value> extract(const Key& key)
+    {
+        if (!find(key))
+        {
+            return {};
+        }
+
+        auto node = own(shardOf(key)).extract(key);
+        _size--;
+
+        auto& value = node.mapped();
+        if (utils::IsSoleOwner(value))
+        {
+            return std::move(*value);
+        }
+
+        return *value;
+    }
+
+    bool erase(const Key& key)
+    {
+        return extract(key).has_value();
+    }
+
+    void clear() noexcept
+    {
+        for (auto& shard : _shards)
+        {
+            shard.reset();
+        }
+
+        _size = 0;
+    }
+
+private:
+    static std::size_t shardOf(const Key& key)
+    {
+        return Hash{}(key) % ShardCount;
+    }
+
+    // the shard with only the entries of this map
+    Shard& own(std::size_t index)
+    {
+        auto& shard = _shards[index];
+        if (!shard)
+        {
+            shard = std::make_shared<Shard>();
+        }
+        else if (!utils::IsSoleOwner(shard))
+        {
+            shard = std::make_shared<Shard>(*shard);
+        }
+
+        return *shard;
+    }
+
+    // the value of an entry of an owned shard with only this map
+    // as its owner
+    static Value& own(ValuePtr& value)
+    {
+        if (!utils::IsSoleOwner(value))
+        {
+            value = std::make_shared<Value>(*value);
+        }
+
+        return *value;
+    }
+};
+
+} // namespace ash
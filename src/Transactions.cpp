@@ -1,3 +1,6 @@
+#include <bit>
+#include <cassert>
+
 #include <nlohmann/json.hpp>
 
 #include "Transactions.h"
@@ -155,31 +158,171 @@ void from_json(const nl::json& j, UnspentTxOuts& outs)
     }
 }
 
-std::string GetTransactionId(const Transaction& tx, std::uint64_t blockid)
+namespace
+{
+
+std::string HexDigest(CryptoPP::SHA256& hash)
+{
+    CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+    hash.Final(digest);
+
+    std::string retval;
+    CryptoPP::StringSource src(digest, sizeof(digest), true,
+        new CryptoPP::HexEncoder(
+            new CryptoPP::StringSink(retval), false));
+
+    return retval;
+}
+
+// streams the canonical binary encoding of values straight into a hash,
+// integers are little-endian, doubles are their IEEE-754 bits and strings
+// are prefixed with their 32-bit length
+class BinaryHashWriter
 {
-    std::stringstream ss;
+    CryptoPP::SHA256&   _hash;
+
+public:
+    explicit BinaryHashWriter(CryptoPP::SHA256& hash)
+        : _hash{ hash }
+    {
+        // nothing to do
+    }
+
+    template<typename T,
+        typename = typename std::enable_if<(std::is_unsigned<T>::value)>::type>
+    void write(T value)
+    {
+        CryptoPP::byte buffer[sizeof(T)];
+        for (std::size_t idx = 0; idx < sizeof(T); idx++)
+        {
+            buffer[idx] = static_cast<CryptoPP::byte>(value >> (idx * 8));
+        }
+
+        _hash.Update(buffer, sizeof(T));
+    }
+
+    void write(double value)
+    {
+        write(std::bit_cast<std::uint64_t>(value));
+    }
+
+    void write(std::string_view value)
+    {
+        write(static_cast<std::uint32_t>(value.size()));
+        _hash.Update(reinterpret_cast<const CryptoPP::byte*>(value.data()), value.size());
+    }
+
+    void write(const TxOutPoint& pt)
+    {
+        write(pt.blockIndex);
+        write(pt.txIndex);
+        write(pt.txOutIndex);
+    }
+
+    void write(const TxOut& txout)
+    {
+        write(txout.address());
+        write(txout.amount());
+    }
+
+    // the address and amount of a TxOutPoint are details filled in for 
+    // display and are not part of the encoding
+    void write(const Transaction& tx)
+    {
+        write(tx.id());
+
+        write(static_cast<std::uint32_t>(tx.txIns().size()));
+        for (const auto& txin : tx.txIns())
+        {
+            write(txin.txOutPt());
+            write(txin.signature());
+        }
+
+        write(static_cast<std::uint32_t>(tx.txOuts().size()));
+        for (const auto& txout : tx.txOuts())
+        {
+            write(txout);
+        }
+    }
+};
+
+} // namespace
+
+std::string GetTransactionId(const Transaction& tx, std::uint64_t blockid, HashVersion version)
+{
+    CryptoPP::SHA256 hash;
+
+    if (version == HashVersion::TEXT)
+    {
+        std::stringstream ss;
+        for (const auto& txin : tx.txIns())
+        {
+            ss << txin.txOutPt().blockIndex
+                << txin.txOutPt().txIndex
+                << txin.txOutPt().txOutIndex;
+        }
+
+        for (const auto& txout : tx.txOuts())
+        {
+            ss << txout.address() << txout.amount();
+        }
+
+        ss << blockid;
+
+        const auto text = ss.str();
+        hash.Update(reinterpret_cast<const CryptoPP::byte*>(text.data()), text.size());
+        return HexDigest(hash);
+    }
+
+    BinaryHashWriter writer{ hash };
+
+    writer.write(static_cast<std::uint32_t>(tx.txIns().size()));
     for (const auto& txin : tx.txIns())
     {
-        ss << txin.txOutPt().blockIndex
-            << txin.txOutPt().txIndex
-            << txin.txOutPt().txOutIndex;
+        writer.write(txin.txOutPt());
     }
 
+    writer.write(static_cast<std::uint32_t>(tx.txOuts().size()));
     for (const auto& txout : tx.txOuts())
     {
-        ss << txout.address() << txout.amount();
+        writer.write(txout);
     }
 
-    ss << blockid;
+    writer.write(blockid);
+    return HexDigest(hash);
+}
 
-    std::string digest;
+std::string GetTransactionsDigest(const Transactions& txs, HashVersion version)
+{
     CryptoPP::SHA256 hash;
 
-    CryptoPP::StringSource src(ss.str(), true,
-        new CryptoPP::HashFilter(hash,
-            new CryptoPP::HexEncoder(
-                new CryptoPP::StringSink(digest), false)));
+    if (version == HashVersion::TEXT)
+    {
+        const auto text = nl::json(txs).dump();
+        hash.Update(reinterpret_cast<const CryptoPP::byte*>(text.data()), text.size());
+        return HexDigest(hash);
+    }
+
+    assert(version == HashVersion::BINARY);
+    BinaryHashWriter writer{ hash };
+
+    writer.write(static_cast<std::uint32_t>(txs.size()));
+    for (const auto& tx : txs)
+    {
+        writer.write(tx);
+    }
+
+    return HexDigest(hash);
+}
+
+HashDigest GetTransactionHash(const Transaction& tx)
+{
+    CryptoPP::SHA256 hash;
+    BinaryHashWriter writer{ hash };
+    writer.write(tx);
 
+    HashDigest digest;
+    hash.Final(digest.data());
     return digest;
 }
 
@@ -192,9 +335,9 @@ Transaction CreateCoinbaseTransaction(std::uint64_t blockIdx, std::string_view a
     return tx;
 }
 
-void Transaction::calcuateId(std::uint64_t blockid)
+void Transaction::calcuateId(std::uint64_t blockid, HashVersion version)
 {
-    _id = ash::GetTransactionId(*this, blockid);
+    _id = ash::GetTransactionId(*this, blockid, version);
 }
 
 } // namespace ash
@@ -3,6 +3,8 @@
 #include <vector>
 #include <sstream>
 #include <chrono>
+#include <array>
+#include <tuple>
 
 #include <boost/functional/hash.hpp>
 
@@ -10,6 +12,8 @@
 
 #include <nlohmann/json.hpp>
 
+#include "SHA256Kernel.h"
+
 namespace nl = nlohmann;
 
 namespace ash
@@ -17,15 +21,35 @@ namespace ash
 
 constexpr double COINBASE_REWARD = 57.00;
 
+// consensus versions of the transaction hashing rules. Every block records
+// the version it was created with, so existing chains keep validating
+// under the rules they were mined with
+enum class HashVersion : std::uint32_t
+{
+    TEXT = 1,       // JSON dump and stream formatted text
+    BINARY = 2,     // canonical length-prefixed little-endian encoding
+    MERKLE = 3      // BINARY ids, the block commits to a Merkle root
+};
+
+constexpr auto CURRENT_HASH_VERSION = HashVersion::MERKLE;
+
 // this feels wrong being in here but I don't want to 
 // define it in multiple places
 using BlockTime = std::chrono::time_point<
     std::chrono::system_clock, std::chrono::milliseconds>;
 
+using HashDigest = std::array<std::uint8_t, crypto::SHA256DigestSize>;
+
 class TxIn;
 class TxOut;
 class Transaction;
 
+namespace db
+{
+class MemoryReader;
+class MemoryWriter;
+}
+
 struct TxOutPoint;
 using UnspentTxOut = TxOutPoint;
 
@@ -117,6 +141,18 @@ public:
 
 Transaction CreateCoinbaseTransaction(std::uint64_t blockIdx, std::string_view address);
 
+std::string GetTransactionId(const Transaction& tx, std::uint64_t blockid, 
+    HashVersion version = CURRENT_HASH_VERSION);
+
+// the hex SHA-256 digest of a block's transactions for the TEXT and
+// BINARY rules, with the BINARY rule the encoding is streamed into the
+// hasher without building a string
+std::string GetTransactionsDigest(const Transactions& txs, HashVersion version);
+
+// SHA-256 of the BINARY encoding of a single transaction, which unlike
+// the id also covers the signatures
+HashDigest GetTransactionHash(const Transaction& tx);
+
 struct TxOutPoint
 {
     std::uint64_t   blockIndex;    // the index of the block
@@ -125,6 +161,25 @@ struct TxOutPoint
 
     std::optional<std::string>  address;
     std::optional<double>       amount;
+
+    // the address and amount are details and do not identify the TxOut
+    bool operator==(const TxOutPoint& other) const noexcept
+    {
+        return blockIndex == other.blockIndex
+            && txIndex == other.txIndex
+            && txOutIndex == other.txOutIndex;
+    }
+
+    bool operator!=(const TxOutPoint& other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+    bool operator<(const TxOutPoint& other) const noexcept
+    {
+        return std::tie(blockIndex, txIndex, txOutIndex)
+            < std::tie(other.blockIndex, other.txIndex, other.txOutIndex);
+    }
 };
 
 class TxIn final
@@ -132,7 +187,7 @@ class TxIn final
     TxOutPoint      _txOutPt;    
     std::string     _signature;
 
-    friend void read_data(std::istream& stream, TxIn& txin);
+    friend void read_data(db::MemoryReader& stream, TxIn& txin);
     friend void from_json(const nl::json& j, TxIn& txin);
 
 public:
@@ -154,7 +209,7 @@ public:
     TxOutPoint& txOutPt() { return _txOutPt; }
     const TxOutPoint& txOutPt() const noexcept { return _txOutPt; }
 
-    std::string signature() const { return _signature; }
+    const std::string& signature() const noexcept { return _signature; }
 };
 
 } // ash
@@ -200,11 +255,11 @@ public:
         // nothing to do
     }
 
-    std::string address() const { return _address; }
+    const std::string& address() const noexcept { return _address; }
     double amount() const noexcept { return _amount; }
 
 private:
-    friend void read_data(std::istream& stream, TxOut& txout);
+    friend void read_data(db::MemoryReader& stream, TxOut& txout);
     friend void from_json(const nl::json& j, TxOut& txout);
 
     std::string _address;   // public-key/address of receiver
@@ -239,12 +294,12 @@ class Transaction final
 
     friend Transaction CreateCoinbaseTransaction(std::uint64_t blockIdx, std::string_view address);
     friend void from_json(const nl::json& j, Transaction& tx);
-    friend void read_data(std::istream& stream, Transaction& tx);
+    friend void read_data(db::MemoryReader& stream, Transaction& tx);
 
 public:
 
-    std::string id() const { return _id; }
-    void calcuateId(std::uint64_t blockid);
+    const std::string& id() const noexcept { return _id; }
+    void calcuateId(std::uint64_t blockid, HashVersion version = CURRENT_HASH_VERSION);
 
     const TxIns& txIns() const { return _txIns; }
     TxIns& txIns()
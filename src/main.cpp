@@ -36,11 +36,50 @@ ash::SettingsPtr registerSettings()
 
     constexpr auto filesizeMin = 1024u;
     constexpr auto filesizeMax = 1024u * 1024u * 1024u;
-    constexpr auto filesizeDefault = 1024u * 1024u * 5u;
+    constexpr auto filesizeDefault = ash::DatabaseFileSizeDefault;
     retval->registerUInt("database.filesize.max", filesizeDefault,
         std::make_shared<ash::RangeValidator<std::uint64_t>>(filesizeMin, filesizeMax));
 
+    retval->registerBool("database.headersonly", false);
+
+    constexpr auto pruneMax = 1024u * 1024u * 1024u;
+    retval->registerUInt("database.prune", 0u,
+        std::make_shared<ash::RangeValidator<std::uint64_t>>(0u, pruneMax));
+
+    constexpr auto snapshotIntervalMax = 1024u * 1024u;
+    retval->registerUInt("database.snapshot.interval", ash::SnapshotIntervalDefault,
+        std::make_shared<ash::RangeValidator<std::uint64_t>>(0u, snapshotIntervalMax));
+
+    retval->registerEnum("database.sync", "group", { "none", "group", "full" });
+
+    const ash::db::TxIndexOptions txIndexDefaults;
+    constexpr auto txIndexCacheMax = 1024u * 1024u * 1024u;
+    retval->registerUInt("database.txindex.cache.size", 
+        static_cast<std::uint32_t>(txIndexDefaults.cacheSize),
+        std::make_shared<ash::RangeValidator<std::uint64_t>>(0u, txIndexCacheMax));
+
+    constexpr auto bloomBitsMax = 64u;
+    retval->registerUInt("database.txindex.bloom.bits", txIndexDefaults.bloomBits,
+        std::make_shared<ash::RangeValidator<std::uint64_t>>(0u, bloomBitsMax));
+
+    constexpr auto writeBufferMin = 64u * 1024u;
+    constexpr auto writeBufferMax = 1024u * 1024u * 1024u;
+    retval->registerUInt("database.txindex.writebuffer.size", 
+        static_cast<std::uint32_t>(txIndexDefaults.writeBufferSize),
+        std::make_shared<ash::RangeValidator<std::uint64_t>>(writeBufferMin, writeBufferMax));
+
+    constexpr auto blockCacheMin = 1u;
+    constexpr auto blockCacheMax = 1024u * 1024u;
+    retval->registerUInt("database.blockcache.size", ash::BlockCacheSizeDefault,
+        std::make_shared<ash::RangeValidator<std::uint64_t>>(blockCacheMin, blockCacheMax));
+
     retval->registerBool("mining.autostart", false);
+
+    constexpr auto threadsMin = 1u;
+    constexpr auto threadsMax = 256u;
+    retval->registerUInt("mining.threads", 1u,
+        std::make_shared<ash::RangeValidator<std::uint64_t>>(threadsMin, threadsMax));
+
     retval->registerString("mining.miner.address", "<CHANGE ME>", 
         std::make_shared<ash::NotEmptyValidator>());
 
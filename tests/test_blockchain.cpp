@@ -2,6 +2,10 @@
 #include <fstream>
 #include <streambuf>
 #include <memory>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <utility>
 
 #include <boost/test/unit_test.hpp>
 #include <boost/test/data/test_case.hpp>
@@ -19,7 +23,9 @@
 #include "../src/Miner.h"
 #include "../src/CryptoUtils.h"
 #include "../src/Transactions.h"
+#include "../src/MerkleTree.h"
 #include "../src/Miner.h"
+#include "../src/AshUtils.h"
 
 namespace nl = nlohmann;
 namespace data = boost::unit_test::data;
@@ -82,6 +88,31 @@ std::ostream& operator<<(std::ostream& out, const ash::AddressLedger& ledger)
 
 }
 
+// counts every heap allocation made by the test process so a test
+// can verify that a code path does not allocate
+std::atomic_size_t AllocationCount = 0;
+
+void* operator new(std::size_t size)
+{
+    AllocationCount++;
+    if (auto ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
 std::string LoadFile(std::string_view filename)
 {
     std::ifstream t(filename.data());
@@ -131,6 +162,147 @@ BOOST_AUTO_TEST_CASE(GetAddressUnspentTxOutsTest)
     BOOST_TEST(stefanUnspent.size() == 1);
 }
 
+// the unspent TxOuts found by walking the entire chain
+ash::UnspentTxOuts ScanUnspentTxOuts(const ash::Blockchain& chain, const std::string& address = {})
+{
+    ash::UnspentTxOuts outs;
+    for (const auto& block : chain)
+    {
+        for (auto txidx = 0u; txidx < block.transactions().size(); txidx++)
+        {
+            const auto& tx = block.transactions().at(txidx);
+            for (auto outidx = 0u; outidx < tx.txOuts().size(); outidx++)
+            {
+                const auto& txout = tx.txOuts().at(outidx);
+                outs.push_back({ block.index(), txidx, outidx, txout.address(), txout.amount() });
+            }
+
+            for (const auto& txin : tx.txIns())
+            {
+                if (!tx.isCoinbase())
+                {
+                    outs.erase(std::remove(outs.begin(), outs.end(), txin.txOutPt()), outs.end());
+                }
+            }
+        }
+    }
+
+    outs.erase(std::remove_if(outs.begin(), outs.end(),
+        [&address](const auto& out) { return !address.empty() && *(out.address) != address; }),
+        outs.end());
+
+    std::sort(outs.begin(), outs.end());
+    return outs;
+}
+
+void CheckUnspentTxOuts(const ash::Blockchain& chain)
+{
+    for (const std::string address : { "", "1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t",
+        "1Cus7TLessdAvkzN2BhK3WD3Ymru48X3z8", "1KHEXSmHaLtz4v8XrHegLzyVuU6SLg7Atw" })
+    {
+        const auto expected = ScanUnspentTxOuts(chain, address);
+        const auto unspent = ash::GetUnspentTxOuts(chain, address);
+        BOOST_TEST(unspent == expected, boost::test_tools::per_element());
+
+        for (auto idx = 0u; idx < std::min(unspent.size(), expected.size()); idx++)
+        {
+            BOOST_TEST(*(unspent[idx].address) == *(expected[idx].address));
+            BOOST_TEST(*(unspent[idx].amount) == *(expected[idx].amount));
+        }
+    }
+}
+
+// the ledger of an address found by walking the entire chain
+ash::AddressLedger ScanAddressLedger(const ash::Blockchain& chain, const std::string& address)
+{
+    ash::AddressLedger ledger;
+    for (const auto& block : chain)
+    {
+        const auto fullblock = ash::GetBlockDetails(chain, block.index());
+        for (const auto& tx : fullblock.transactions())
+        {
+            std::optional<double> credit;
+            for (const auto& txout : tx.txOuts())
+            {
+                if (txout.address() == address)
+                {
+                    credit = txout.amount();
+                    break;
+                }
+            }
+
+            if (!tx.isCoinbase() && *(tx.txIns().at(0).txOutPt().address) == address)
+            {
+                double txInTotal = 0.0;
+                for (const auto& txin : tx.txIns())
+                {
+                    txInTotal += *(txin.txOutPt().amount);
+                }
+
+                const auto amount = txInTotal - credit.value_or(0.0);
+                ledger.push_back({ block.index(), tx.id(), block.time(), amount * -1.0 });
+            }
+            else if (credit.has_value())
+            {
+                ledger.push_back({ block.index(), tx.id(), block.time(), *credit });
+            }
+        }
+    }
+
+    return ledger;
+}
+
+void CheckAddressLedgers(const ash::Blockchain& chain)
+{
+    for (const std::string address : { "1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t",
+        "1Cus7TLessdAvkzN2BhK3WD3Ymru48X3z8", "1KHEXSmHaLtz4v8XrHegLzyVuU6SLg7Atw" })
+    {
+        const auto expected = ScanAddressLedger(chain, address);
+        const auto& ledger = chain.addressLedger(address);
+        BOOST_TEST(ledger == expected, boost::test_tools::per_element());
+
+        for (auto idx = 0u; idx < std::min(ledger.size(), expected.size()); idx++)
+        {
+            BOOST_TEST(ledger[idx].amount == expected[idx].amount);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(IncrementalChainIndexTest)
+{
+    auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_TEST(chain.size() == 4);
+    CheckUnspentTxOuts(chain);
+    CheckAddressLedgers(chain);
+
+    auto [result, newtx] = ash::CreateTransaction(chain, "1b3f78b45456dcfc3a2421da1d9961abd944b7e8a7c2ccc809a7ea92e200eeb1h",
+                                    "1KHEXSmHaLtz4v8XrHegLzyVuU6SLg7Atw", 100.0);
+    BOOST_TEST((result == ash::TxResult::SUCCESS));
+    chain.queueTransaction(std::move(newtx));
+
+    ash::Miner miner;
+    miner.setDifficulty(0);
+    auto newblock = chain.createUnminedBlock("1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t");
+    BOOST_TEST(miner.mineBlock(*newblock, [](std::uint64_t) { return true; }) == ash::Miner::SUCCESS);
+    BOOST_TEST(chain.addNewBlock(*newblock));
+    BOOST_TEST(chain.size() == 5);
+    CheckUnspentTxOuts(chain);
+    CheckAddressLedgers(chain);
+
+    // rolling blocks back restores what they spent
+    for (auto size = 4u; size > 0; size--)
+    {
+        chain.resize(size);
+        BOOST_TEST(chain.size() == size);
+        CheckUnspentTxOuts(chain);
+        CheckAddressLedgers(chain);
+    }
+
+    chain.clear();
+    BOOST_TEST(ash::GetUnspentTxOuts(chain).empty());
+    BOOST_TEST(chain.addressLedger("1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t").empty());
+}
+
 BOOST_AUTO_TEST_CASE(GetAddressLedgerTest)
 {
     auto ledgerSort = [](const ash::LedgerInfo& x, const ash::LedgerInfo& y)
@@ -212,6 +384,491 @@ BOOST_AUTO_TEST_CASE(SingleQueueTransactionTest)
     BOOST_TEST(stefanBalance == 10.00, boost::test_tools::tolerance(0.001));
 }
 
+BOOST_AUTO_TEST_CASE(MultiThreadedMineBlockTest)
+{
+    auto chain = LoadBlockchain("blockchain1.json");
+    BOOST_TEST(chain.size() == 1);
+
+    ash::Miner miner;
+    miner.setDifficulty(2);
+    miner.setThreadCount(4);
+    BOOST_TEST(miner.threadCount() == 4);
+
+    auto newblock = chain.createUnminedBlock("1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t");
+    auto mineResult = miner.mineBlock(*newblock, [](std::uint64_t) { return true; });
+    BOOST_TEST(mineResult == ash::Miner::SUCCESS);
+    BOOST_TEST(newblock->difficulty() == 2);
+    BOOST_TEST(ash::ValidHash(*newblock));
+    BOOST_TEST(chain.addNewBlock(*newblock));
+    BOOST_TEST(chain.size() == 2);
+
+    // the callback telling the miner to bail stops all of the workers
+    auto abortedblock = chain.createUnminedBlock("1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t");
+    miner.setDifficulty(64);
+    mineResult = miner.mineBlock(*abortedblock, [](std::uint64_t) { return false; });
+    BOOST_TEST(mineResult == ash::Miner::ABORT);
+}
+
+BOOST_AUTO_TEST_CASE(BlockHasherTest)
+{
+    const auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_TEST(chain.size() == 4);
+
+    for (const auto& block : chain)
+    {
+        const auto extra = 
+            ash::crypto::SHA256(nl::json(block.transactions()).dump());
+
+        ash::BlockHasher hasher{ block.index(), block.difficulty(), block.data(), block.previousHash(), extra };
+        hasher.setTime(block.time());
+        BOOST_TEST(hasher.hash(block.nonce()) == ash::CalculateBlockHash(block));
+
+        for (const std::uint64_t nonce : { 0ull, 9ull, 10ull, 123456789ull, 18446744073709551615ull })
+        {
+            const auto time = block.time() + std::chrono::milliseconds{ nonce % 1000 };
+            hasher.setTime(time);
+
+            const auto expected = ash::CalculateBlockHash(block.index(), nonce, block.difficulty(), 
+                time, block.data(), block.previousHash(), extra);
+
+            BOOST_TEST(hasher.hash(nonce) == expected);
+        }
+
+        // every kernel hashing a batch of nonces, including batches that 
+        // cross a power of ten
+        for (const auto kernel : ash::crypto::GetSupportedSHA256Kernels())
+        {
+            ash::BlockHasher khasher{ block.index(), block.difficulty(), block.data(), block.previousHash(), extra, *kernel };
+            khasher.setTime(block.time());
+
+            for (const std::uint64_t first : { 0ull, 5ull, 9990ull, 123456789ull })
+            {
+                std::array<ash::HashDigest, ash::crypto::SHA256MaxLanes> digests;
+                khasher.hash(first, 3, digests.size(), digests.data());
+
+                for (std::size_t idx = 0; idx < digests.size(); idx++)
+                {
+                    const auto expected = ash::CalculateBlockHash(block.index(), first + (idx * 3), 
+                        block.difficulty(), block.time(), block.data(), block.previousHash(), extra);
+
+                    BOOST_TEST(ash::ToHexString(digests[idx]) == expected);
+                }
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(AllocationFreeHashLoopTest)
+{
+    const auto chain = LoadBlockchain("blockchain4.json");
+    const auto& block = chain.at(3);
+    const auto extra = 
+        ash::crypto::SHA256(nl::json(block.transactions()).dump());
+
+    ash::BlockHasher hasher{ block.index(), block.difficulty(), block.data(), block.previousHash(), extra };
+    hasher.setTime(block.time());
+
+    ash::HashDigest digest;
+    std::size_t matches = 0;
+
+    const auto before = AllocationCount.load();
+    for (std::uint64_t nonce = 0; nonce < 10000; nonce++)
+    {
+        hasher.hash(nonce, digest);
+        if (ash::HasLeadingZeros(digest, 2)) matches++;
+    }
+    BOOST_TEST(AllocationCount.load() == before);
+
+    // the raw digest check agrees with comparing the hex string
+    for (std::uint64_t nonce = 0; nonce < 500; nonce++)
+    {
+        hasher.hash(nonce, digest);
+        const auto hex = ash::ToHexString(digest);
+        BOOST_TEST(hex == hasher.hash(nonce));
+
+        for (auto difficulty = 0u; difficulty < 5; difficulty++)
+        {
+            const std::string zeros(difficulty, '0');
+            BOOST_TEST(ash::HasLeadingZeros(digest, difficulty) 
+                == (hex.compare(0, difficulty, zeros) == 0));
+        }
+    }
+
+    BOOST_TEST(!ash::HasLeadingZeros(digest, 65));
+    BOOST_TEST(matches > 0);
+}
+
+BOOST_AUTO_TEST_CASE(TxDigestCacheTest)
+{
+    auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_TEST(chain.size() == 4);
+    BOOST_TEST(chain.isValidChain());
+
+    for (const auto& block : chain)
+    {
+        BOOST_TEST(block.txDigest() 
+            == ash::crypto::SHA256(nl::json(block.transactions()).dump()));
+    }
+
+    // changing a transaction through the chain invalidates the digest
+    const auto before = chain.at(3).txDigest();
+    chain.txAt(3, 1).txOuts().at(0) = ash::TxOut{ "1Cus7TLessdAvkzN2BhK3WD3Ymru48X3z8", 1000.0 };
+    BOOST_TEST(chain.at(3).txDigest() != before);
+    BOOST_TEST(!chain.isValidChain());
+
+    // as does changing them through the block
+    auto block = chain.at(1);
+    const auto copyDigest = block.txDigest();
+    block.transactions().pop_back();
+    BOOST_TEST(block.txDigest() != copyDigest);
+    BOOST_TEST(block.txDigest()
+        == ash::crypto::SHA256(nl::json(block.transactions()).dump()));
+
+    // dropping the transactions keeps the digest and the Merkle root
+    auto dropped = chain.at(2);
+    dropped.dropTransactions();
+    BOOST_TEST(!dropped.hasTransactions());
+    BOOST_TEST(dropped.txDigest() == chain.at(2).txDigest());
+    BOOST_TEST(dropped.merkleRoot() == chain.at(2).merkleRoot());
+}
+
+BOOST_AUTO_TEST_CASE(PrunedPeerChainTest)
+{
+    const auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_TEST(ash::IsValidPeerChain(chain));
+    BOOST_TEST(!ash::IsValidPeerChain(ash::Blockchain{}));
+
+    // a peer can send a block as pruned with a digest of its choosing
+    nl::json json = chain;
+    json[2]["pruned"] = true;
+    json[2]["txdigest"] = chain.at(2).txDigest();
+    json[2]["transactions"] = nl::json::array();
+
+    const auto tempchain = json.get<ash::Blockchain>();
+    BOOST_TEST(!tempchain.at(2).hasTransactions());
+    BOOST_TEST(tempchain.isValidChain());
+    BOOST_TEST(!ash::IsValidPeerChain(tempchain));
+}
+
+BOOST_AUTO_TEST_CASE(HashVersionTest)
+{
+    // chains saved before blocks recorded a version use the TEXT rules
+    auto chain = LoadBlockchain("blockchain1.json");
+    BOOST_TEST(chain.size() == 1);
+    BOOST_TEST((chain.at(0).version() == ash::HashVersion::TEXT));
+
+    ash::Miner miner;
+    miner.setDifficulty(1);
+
+    auto newblock = chain.createUnminedBlock("1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t");
+    BOOST_TEST((newblock->version() == ash::CURRENT_HASH_VERSION));
+    BOOST_TEST(newblock->txDigest() == newblock->merkleRoot());
+    BOOST_TEST(newblock->txDigest()
+        != ash::GetTransactionsDigest(newblock->transactions(), ash::HashVersion::BINARY));
+    BOOST_TEST(newblock->txDigest()
+        != ash::GetTransactionsDigest(newblock->transactions(), ash::HashVersion::TEXT));
+
+    const auto& coinbase = newblock->transactions().at(0);
+    BOOST_TEST(coinbase.id() == ash::GetTransactionId(coinbase, 1, ash::HashVersion::BINARY));
+    BOOST_TEST(coinbase.id() != ash::GetTransactionId(coinbase, 1, ash::HashVersion::TEXT));
+
+    auto mineResult = miner.mineBlock(*newblock, [](std::uint64_t) { return true; });
+    BOOST_TEST(mineResult == ash::Miner::SUCCESS);
+    BOOST_TEST(chain.addNewBlock(*newblock));
+    BOOST_TEST(chain.size() == 2);
+
+    // a chain that mixes the versions stays valid
+    BOOST_TEST(chain.isValidChain());
+
+    // the version survives the trip through JSON
+    const nl::json json = chain.at(1);
+    const auto copy = json.get<ash::Block>();
+    BOOST_TEST((copy.version() == ash::HashVersion::MERKLE));
+    BOOST_TEST(copy.txDigest() == chain.at(1).txDigest());
+
+    // hashing the block with other rules invalidates it
+    auto block = chain.at(1);
+    block.setVersion(ash::HashVersion::BINARY);
+    BOOST_TEST(ash::CalculateBlockHash(block) != block.hash());
+    block.setVersion(ash::HashVersion::TEXT);
+    BOOST_TEST(ash::CalculateBlockHash(block) != block.hash());
+
+    auto badjson = json;
+    badjson["version"] = 4;
+    BOOST_CHECK_THROW(badjson.get<ash::Block>(), std::logic_error);
+}
+
+// a straightforward recursive Merkle root to check the parallel one against
+ash::HashDigest ReferenceMerkleRoot(const std::vector<ash::HashDigest>& level)
+{
+    if (level.size() == 1)
+    {
+        return level.front();
+    }
+
+    std::vector<ash::HashDigest> next;
+    for (std::size_t idx = 0; idx < level.size(); idx += 2)
+    {
+        next.push_back(idx + 1 < level.size()
+            ? ash::GetMerkleNode(level[idx], level[idx + 1])
+            : level[idx]);
+    }
+
+    return ReferenceMerkleRoot(next);
+}
+
+BOOST_DATA_TEST_CASE(ParallelForErrorTest, data::make({ std::size_t{0}, std::size_t{999} }), throwAt)
+{
+    // the chunk with `throwAt` throws, on the calling thread for the
+    // first chunk and on a worker for the last one
+    std::atomic<std::size_t> visited = 0;
+    const auto parallelFor = 
+        [&visited, throwAt]()
+        {
+            utils::ParallelFor(1000, 1,
+                [&visited, throwAt](std::size_t begin, std::size_t end)
+                {
+                    if (begin <= throwAt && throwAt < end)
+                    {
+                        throw std::runtime_error("chunk failed");
+                    }
+
+                    visited += end - begin;
+                });
+        };
+
+    BOOST_CHECK_THROW(parallelFor(), std::runtime_error);
+
+    // the other chunks ran to the end before the error was rethrown
+    BOOST_TEST(visited < 1000u);
+    BOOST_TEST((std::thread::hardware_concurrency() <= 1 || visited > 0u));
+}
+
+BOOST_DATA_TEST_CASE(MerkleTreeTest, data::make({ 1, 2, 3, 4, 5, 7, 8, 9, 33, 5000 }), txcount)
+{
+    ash::Transactions txs;
+    std::vector<ash::HashDigest> leaves;
+    for (auto idx = 0; idx < txcount; idx++)
+    {
+        txs.push_back(ash::CreateCoinbaseTransaction(idx, "1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t"));
+        leaves.push_back(ash::GetMerkleLeaf(txs.back()));
+    }
+
+    const auto root = ash::GetMerkleRoot(txs);
+    BOOST_TEST((root == ReferenceMerkleRoot(leaves)));
+
+    // checking every proof of the large tree would take a while
+    const std::size_t step = txs.size() > 100 ? 997 : 1;
+    for (std::size_t idx = 0; idx < txs.size(); idx += step)
+    {
+        const auto proof = ash::GetMerkleProof(txs, idx);
+        BOOST_TEST(ash::VerifyMerkleProof(txs[idx], proof, root));
+
+        // the proof only holds for its own transaction
+        if (txs.size() > 1)
+        {
+            BOOST_TEST(!ash::VerifyMerkleProof(txs[(idx + 1) % txs.size()], proof, root));
+        }
+
+        // and survives the trip through JSON
+        const nl::json json = proof;
+        BOOST_TEST(ash::VerifyMerkleProof(txs[idx], json.get<ash::MerkleProof>(), root));
+
+        if (!proof.empty())
+        {
+            auto badproof = proof;
+            badproof.front().left = !badproof.front().left;
+            BOOST_TEST(!ash::VerifyMerkleProof(txs[idx], badproof, root));
+        }
+    }
+
+    BOOST_CHECK_THROW(ash::GetMerkleProof(txs, txs.size()), std::logic_error);
+
+    // the root is cached on the block until the transactions change
+    ash::Block block{ 1, "prev", std::move(txs) };
+    BOOST_TEST(block.merkleRoot() == ash::ToHexString(root));
+    block.transactions().pop_back();
+    if (txcount > 1)
+    {
+        BOOST_TEST(block.merkleRoot() != ash::ToHexString(root));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(CumDifficultyTest)
+{
+    auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_TEST(chain.size() == 4);
+
+    auto checkCumDifficulty = 
+        [](const ash::Blockchain& chain)
+        {
+            std::uint64_t total = 0;
+            for (auto idx = 0u; idx <= chain.size(); idx++)
+            {
+                BOOST_TEST(chain.cumDifficulty(idx) == total);
+                if (idx < chain.size())
+                {
+                    total += std::uint64_t{1} << chain.at(idx).difficulty();
+                }
+            }
+
+            BOOST_TEST(chain.cumDifficulty() == chain.cumDifficulty(chain.size() - 1));
+        };
+
+    checkCumDifficulty(chain);
+
+    ash::Miner miner;
+    miner.setDifficulty(3);
+    auto newblock = chain.createUnminedBlock("1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t");
+    BOOST_TEST(miner.mineBlock(*newblock, [](std::uint64_t) { return true; }) == ash::Miner::SUCCESS);
+    BOOST_TEST(chain.addNewBlock(*newblock));
+    checkCumDifficulty(chain);
+
+    chain.resize(2);
+    checkCumDifficulty(chain);
+
+    chain.clear();
+    BOOST_TEST(chain.cumDifficulty() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(SegmentedVectorTest)
+{
+    ash::SegmentedVector<std::string, 4> items;
+    items.push_back("0");
+    const auto& first = items.front();
+    const auto* firstAddress = &first;
+
+    for (auto idx = 1u; idx < 10; idx++)
+    {
+        items.push_back(std::to_string(idx));
+    }
+
+    // appending across segments does not move the existing items
+    BOOST_TEST(items.size() == 10);
+    BOOST_TEST(&items.front() == firstAddress);
+    BOOST_TEST(first == "0");
+    BOOST_TEST(items.back() == "9");
+    BOOST_TEST(std::distance(items.begin(), items.end()) == 10);
+    BOOST_TEST(*std::find(items.begin(), items.end(), "6") == "6");
+    BOOST_TEST(items.rbegin()->compare("9") == 0);
+    BOOST_CHECK_THROW(items.at(10), std::out_of_range);
+
+    // a copy shares the segments, changing it leaves the vector alone
+    auto shared = items;
+    BOOST_TEST(&std::as_const(shared).front() == firstAddress);
+    shared.pop_back();
+    shared.push_back("x");
+    shared[0] = "y";
+    BOOST_TEST(std::as_const(items).back() == "9");
+    BOOST_TEST(&std::as_const(items).front() == firstAddress);
+    BOOST_TEST(first == "0");
+    BOOST_TEST(shared.size() == 10);
+    BOOST_TEST(std::as_const(shared).front() == "y");
+    BOOST_TEST(std::as_const(shared).back() == "x");
+
+    // copies get segments they can grow into
+    auto copy = items;
+    const auto* fifth = &copy.at(4);
+    copy.push_back("10");
+    copy.push_back("11");
+    copy.push_back("12");
+    BOOST_TEST(&copy.at(4) == fifth);
+    BOOST_TEST(items.size() == 10);
+
+    while (copy.size() > 3)
+    {
+        copy.pop_back();
+    }
+
+    BOOST_TEST(copy.back() == "2");
+    BOOST_TEST(&copy.front() != firstAddress);
+    copy.clear();
+    BOOST_TEST(copy.empty());
+}
+
+BOOST_AUTO_TEST_CASE(ShardedMapTest)
+{
+    ash::ShardedMap<std::string, int, std::hash<std::string>, 4> items;
+    for (auto idx = 0; idx < 20; idx++)
+    {
+        BOOST_TEST(items.emplace(std::to_string(idx), idx));
+    }
+
+    BOOST_TEST(!items.emplace("3", 30));
+    BOOST_TEST(items.size() == 20);
+    BOOST_TEST(*items.find("3") == 3);
+    BOOST_TEST(!items.find("20"));
+    BOOST_TEST(std::distance(items.begin(), items.end()) == 20);
+
+    // a copy shares the shards, changing it leaves the map alone
+    const auto* shared = items.find("5");
+    auto copy = items;
+    BOOST_TEST(copy.find("5") == shared);
+    *copy.modify("5") = 50;
+    copy["20"] = 20;
+    BOOST_TEST(copy.extract("7").value() == 7);
+    BOOST_TEST(!copy.erase("7"));
+    BOOST_TEST(!copy.modify("7"));
+
+    BOOST_TEST(items.find("5") == shared);
+    BOOST_TEST(*items.find("5") == 5);
+    BOOST_TEST(copy.find("5") != shared);
+
+    // the values that were not changed are still shared
+    for (const auto key : { "0", "1", "2", "3", "4", "6", "8", "9" })
+    {
+        BOOST_TEST(copy.find(key) == items.find(key));
+    }
+
+    BOOST_TEST(*items.find("7") == 7);
+    BOOST_TEST(!items.find("20"));
+    BOOST_TEST(items.size() == 20);
+    BOOST_TEST(*copy.find("5") == 50);
+    BOOST_TEST(copy.size() == 20);
+
+    auto sum = 0;
+    for (const auto& [key, value] : copy)
+    {
+        sum += value;
+    }
+
+    BOOST_TEST(sum == 190 - 7 - 5 + 50 + 20);
+
+    copy.clear();
+    BOOST_TEST(copy.empty());
+    BOOST_TEST((copy.begin() == copy.end()));
+    BOOST_TEST(items.size() == 20);
+}
+
+BOOST_AUTO_TEST_CASE(ChainSnapshotTest)
+{
+    auto chain = LoadBlockchain("blockchain4.json");
+    const auto snapshot = std::make_shared<const ash::Blockchain>(chain);
+    const auto unspent = snapshot->unspentTxOuts();
+    const auto cumdiff = snapshot->cumDifficulty();
+
+    // changing the chain leaves the snapshot and its indexes alone
+    ash::Miner miner;
+    miner.setDifficulty(3);
+    auto newblock = chain.createUnminedBlock("1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t");
+    BOOST_TEST(miner.mineBlock(*newblock, [](std::uint64_t) { return true; }) == ash::Miner::SUCCESS);
+    BOOST_TEST(chain.addNewBlock(*newblock));
+    chain.resize(2);
+
+    BOOST_TEST(snapshot->size() == 4);
+    BOOST_TEST(snapshot->isValidChain());
+    BOOST_TEST(snapshot->cumDifficulty() == cumdiff);
+    BOOST_TEST((snapshot->unspentTxOuts() == unspent));
+    BOOST_TEST((snapshot->unspentTxOuts() == ash::GetUnspentTxOuts(LoadBlockchain("blockchain4.json"))));
+
+    // the queued transactions are shared until the chain changes them
+    chain.queueTransaction(ash::CreateCoinbaseTransaction(2, "1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t"));
+    const auto queued = std::make_shared<const ash::Blockchain>(chain);
+    chain.queueTransaction(ash::CreateCoinbaseTransaction(3, "1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t"));
+    BOOST_TEST(queued->transactionQueueSize() == 1);
+    BOOST_TEST(chain.transactionQueueSize() == 2);
+}
+
 BOOST_AUTO_TEST_CASE(InsufficientFundsQueueTransactionTest)
 {
     auto chain = LoadBlockchain("blockchain1.json");
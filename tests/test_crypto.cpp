@@ -13,6 +13,8 @@
 #include "../src/Blockchain.h"
 #include "../src/Miner.h"
 #include "../src/CryptoUtils.h"
+#include "../src/SHA256Kernel.h"
+#include "../src/CRC32C.h"
 
 namespace nl = nlohmann;
 namespace data = boost::unit_test::data;
@@ -51,4 +53,99 @@ BOOST_DATA_TEST_CASE(addressGenTest, data::make(addressGenData), pk, expected)
     BOOST_TEST(address == expected);
 }
 
+// hashes `message` with every supported kernel, both on its own and as 
+// every lane of a multi-lane batch
+BOOST_DATA_TEST_CASE(sha256KernelTest, data::make({ 0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 200, 1000 }), length)
+{
+    std::string message;
+    for (auto idx = 0; idx < length; idx++)
+    {
+        message.push_back(static_cast<char>('a' + (idx * 7) % 26));
+    }
+
+    const auto expected = ash::crypto::SHA256(message);
+
+    // pad the message the way SHA-256 expects
+    std::vector<std::uint8_t> padded(message.begin(), message.end());
+    padded.push_back(0x80);
+    while ((padded.size() % ash::crypto::SHA256BlockSize) != 56)
+    {
+        padded.push_back(0);
+    }
+
+    const std::uint64_t bitLength = message.size() * 8;
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+        padded.push_back(static_cast<std::uint8_t>(bitLength >> shift));
+    }
+
+    const auto blocks = padded.size() / ash::crypto::SHA256BlockSize;
+    auto toHex = 
+        [](const ash::crypto::SHA256State& state)
+        {
+            std::uint8_t digest[ash::crypto::SHA256DigestSize];
+            ash::crypto::SHA256StateToDigest(state, digest);
+
+            std::string hex;
+            for (auto byte : digest)
+            {
+                hex += fmt::format("{:02x}", byte);
+            }
+            return hex;
+        };
+
+    for (const auto kernel : ash::crypto::GetSupportedSHA256Kernels())
+    {
+        BOOST_TEST_CONTEXT("kernel " << kernel->name)
+        {
+            auto state = ash::crypto::SHA256InitialState;
+            kernel->transform(state, padded.data(), blocks);
+            BOOST_TEST(toHex(state) == expected);
+
+            for (std::size_t lanes = 1; lanes <= ash::crypto::SHA256MaxLanes; lanes++)
+            {
+                std::vector<ash::crypto::SHA256State> states(lanes, ash::crypto::SHA256InitialState);
+                std::vector<const std::uint8_t*> messages(lanes, padded.data());
+                kernel->transformLanes(states.data(), messages.data(), blocks, lanes);
+
+                for (const auto& laneState : states)
+                {
+                    BOOST_TEST(toHex(laneState) == expected);
+                }
+            }
+        }
+    }
+}
+
+// checks every supported kernel against the table kernel, with every
+// alignment and tail length of the wider kernels
+BOOST_DATA_TEST_CASE(crc32cKernelTest, data::make({ 0, 1, 3, 4, 7, 8, 9, 15, 16, 17, 100, 1000 }), length)
+{
+    std::vector<std::uint8_t> message;
+    for (auto idx = 0; idx < length + 8; idx++)
+    {
+        message.push_back(static_cast<std::uint8_t>(idx * 31 + 7));
+    }
+
+    const auto& table = *(ash::crypto::GetSupportedCRC32CKernels().front());
+    for (const auto kernel : ash::crypto::GetSupportedCRC32CKernels())
+    {
+        BOOST_TEST_CONTEXT("kernel " << kernel->name)
+        {
+            BOOST_TEST(kernel->extend(0, reinterpret_cast<const std::uint8_t*>("123456789"), 9) == 0xe3069283u);
+
+            for (std::size_t offset = 0; offset < 8; offset++)
+            {
+                const auto data = message.data() + offset;
+                const auto expected = table.extend(0, data, length);
+                BOOST_TEST(kernel->extend(0, data, length) == expected);
+
+                // extending in two parts gives the same CRC
+                const auto half = static_cast<std::size_t>(length / 2);
+                BOOST_TEST(kernel->extend(kernel->extend(0, data, half), data + half, length - half) == expected);
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END() // crypto
\ No newline at end of file
@@ -0,0 +1,976 @@
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <chrono>
+#include <cstring>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include <nlohmann/json.hpp>
+
+#include <test-config.h>
+
+#include "../src/Block.h"
+#include "../src/Blockchain.h"
+#include "../src/ChainDatabase.h"
+
+namespace nl = nlohmann;
+
+using namespace std::string_view_literals;
+
+namespace
+{
+
+ash::Blockchain LoadBlockchain(std::string_view chainfile)
+{
+    const std::string filename = fmt::format("{}/tests/data/{}", ASH_SRC_DIRECTORY, chainfile);
+    std::ifstream t(filename);
+    const std::string rawjson((std::istreambuf_iterator<char>(t)),
+                    std::istreambuf_iterator<char>());
+
+    nl::json json = nl::json::parse(rawjson, nullptr, false);
+    BOOST_TEST(!json.is_discarded());
+    return json["blocks"].get<ash::Blockchain>();
+}
+
+std::string ReadFile(const boost::filesystem::path& file)
+{
+    std::ifstream t(file.string(), std::ios_base::binary);
+    return std::string((std::istreambuf_iterator<char>(t)),
+                    std::istreambuf_iterator<char>());
+}
+
+// a database folder that is removed when the test is done
+struct TempFolder
+{
+    boost::filesystem::path path;
+
+    TempFolder()
+        : path{ boost::filesystem::temp_directory_path()
+            / boost::filesystem::unique_path("ash-test-%%%%-%%%%-%%%%") }
+    {
+        boost::filesystem::create_directories(path);
+    }
+
+    ~TempFolder()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(path, ec);
+    }
+};
+
+// a block with only a coinbase transaction that can be added to `chain`
+ash::Block CreateCoinbaseBlock(const ash::Blockchain& chain)
+{
+    auto block = ash::Block{ chain.size(), chain.back().hash(), 
+        { ash::CreateCoinbaseTransaction(chain.size(), "1LahaosvBaCG4EbDamyvuRmcrqc5P2iv7t") } };
+    block.setMinedData(0, 0, block.time(), {});
+    block.setMinedData(0, 0, block.time(), ash::CalculateBlockHash(block));
+    return block;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(database)
+
+BOOST_AUTO_TEST_CASE(MemoryReaderTest)
+{
+    std::ostringstream stream;
+    ash::db::write_data<std::uint64_t>(stream, 42);
+    ash::db::write_data(stream, "hello"sv);
+    ash::db::write_data(stream, 1.5);
+    ash::db::write_data(stream, "world"sv);
+    const auto data = stream.str();
+
+    ash::db::MemoryReader reader{ data.data(), data.size() };
+
+    std::uint64_t number = 0;
+    ash::db::read_data(reader, number);
+    BOOST_TEST(number == 42u);
+
+    // views point into the memory that is read
+    std::string_view view;
+    ash::db::read_data(reader, view);
+    BOOST_TEST(view == "hello"sv);
+    BOOST_TEST((view.data() == data.data() + sizeof(std::uint64_t) + sizeof(ash::db::StrLenType)));
+
+    double real = 0;
+    ash::db::read_data(reader, real);
+    BOOST_TEST(real == 1.5);
+
+    std::string text;
+    ash::db::read_data(reader, text);
+    BOOST_TEST(text == "world");
+    BOOST_TEST(reader.eof());
+    BOOST_TEST(static_cast<bool>(reader));
+
+    // reading past the end fails the reader
+    ash::db::read_data(reader, number);
+    BOOST_TEST(!reader);
+
+    ash::db::MemoryReader truncated{ data.data(), data.size() - 1 };
+    truncated.seek(sizeof(std::uint64_t) + sizeof(ash::db::StrLenType) + 5 + sizeof(double));
+    ash::db::read_data(truncated, text);
+    BOOST_TEST(!truncated);
+}
+
+BOOST_AUTO_TEST_CASE(MemoryWriterTest)
+{
+    std::ostringstream stream;
+    ash::db::write_data<std::uint64_t>(stream, 42);
+    ash::db::write_data(stream, "hello"sv);
+    ash::db::write_data(stream, 1.5);
+
+    // the buffer holds the same encoding as a stream
+    ash::db::MemoryWriter writer;
+    writer.reserve(sizeof(std::uint64_t) + ash::db::encoded_size("hello"sv) + sizeof(double));
+    ash::db::write_data<std::uint64_t>(writer, 42);
+    ash::db::write_data(writer, "hello"sv);
+    ash::db::write_data(writer, 1.5);
+    BOOST_TEST(std::string(writer.data(), writer.size()) == stream.str());
+
+    // each block record decodes back to the same block
+    const auto chain = LoadBlockchain("blockchain4.json");
+    for (const auto& block : chain)
+    {
+        std::ostringstream record;
+        write_block(record, block);
+        const auto data = record.str();
+
+        ash::db::MemoryReader reader{ data.data(), data.size() };
+        ash::Block loaded;
+        read_block(reader, loaded, 2);
+        BOOST_TEST(reader.eof());
+        BOOST_TEST((loaded == block));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(WriteAndLoadChainTest)
+{
+    TempFolder folder;
+    auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_TEST(chain.size() == 4);
+
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.writeChain(chain);
+    }
+
+    // new files start with the header
+    const auto raw = ReadFile(folder.path / "chain.ashdb");
+    BOOST_TEST(raw.substr(0, 8) == "ASHCHAIN"sv);
+
+    ash::Blockchain loaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(loaded, nullptr);
+
+    BOOST_TEST(loaded.size() == chain.size());
+    for (auto idx = 0u; idx < chain.size(); idx++)
+    {
+        BOOST_TEST((loaded.at(idx) == chain.at(idx)));
+        BOOST_TEST(loaded.at(idx).hash() == chain.at(idx).hash());
+        BOOST_TEST((loaded.at(idx).version() == chain.at(idx).version()));
+        BOOST_TEST(loaded.at(idx).txDigest() == chain.at(idx).txDigest());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(LegacyDatabaseUpgradeTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+
+    // legacy records are the current records without the leading version
+    {
+        std::ofstream ofs((folder.path / "chain.ashdb").string(), std::ios::binary);
+        for (const auto& block : chain)
+        {
+            std::ostringstream record;
+            write_block(record, block);
+            ofs << record.str().substr(sizeof(std::uint32_t));
+        }
+    }
+
+    ash::Blockchain loaded;
+
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.initialize(loaded, nullptr);
+    }
+
+    BOOST_TEST(loaded.size() == chain.size());
+    BOOST_TEST(loaded.isValidChain());
+    for (const auto& block : loaded)
+    {
+        BOOST_TEST((block.version() == ash::HashVersion::TEXT));
+    }
+
+    // loading the legacy file upgraded it
+    const auto raw = ReadFile(folder.path / "chain.ashdb");
+    BOOST_TEST(raw.substr(0, 8) == "ASHCHAIN"sv);
+
+    ash::Blockchain reloaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(reloaded, nullptr);
+    BOOST_TEST(reloaded.size() == chain.size());
+    BOOST_TEST(reloaded.isValidChain());
+}
+
+BOOST_AUTO_TEST_CASE(TxIndexTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+
+    // a database written before the index existed
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.writeChain(chain);
+    }
+
+    auto waitForIndex = 
+        [](const ash::ChainDatabase& db)
+        {
+            for (auto tries = 0u; tries < 500 && !db.txIndexReady(); tries++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            return db.txIndexReady();
+        };
+
+    auto checkIndex = 
+        [](const ash::Blockchain& chain, const ash::ChainDatabase& db)
+        {
+            for (const auto& block : chain)
+            {
+                for (auto txidx = 0u; txidx < block.transactions().size(); txidx++)
+                {
+                    // the test chain has a duplicate txid so only check 
+                    // that the index points at a transaction with the id
+                    const auto& txid = block.transactions().at(txidx).id();
+                    const auto txpt = ash::FindTransaction(chain, db, txid);
+                    BOOST_TEST(db.findTransaction(txid).has_value());
+                    BOOST_TEST((txpt == db.findTransaction(txid)));
+                    BOOST_TEST(txpt.has_value());
+                    if (txpt.has_value())
+                    {
+                        const auto [blockIndex, txIndex] = *txpt;
+                        BOOST_TEST(chain.txAt(blockIndex, txIndex).id() == txid);
+                    }
+                }
+            }
+        };
+
+    {
+        // the index is rebuilt in the background
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string() };
+        db.initialize(loaded, nullptr);
+        BOOST_TEST(waitForIndex(db));
+        checkIndex(loaded, db);
+
+        BOOST_TEST(!db.findTransaction("notatransaction").has_value());
+        BOOST_TEST(!ash::FindTransaction(loaded, db, "notatransaction").has_value());
+    }
+
+    ash::Blockchain loaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(loaded, nullptr);
+
+    // and is ready right away once it is complete
+    BOOST_TEST(db.txIndexReady());
+    checkIndex(loaded, db);
+
+    // written blocks are added to the index
+    auto block = CreateCoinbaseBlock(loaded);
+    BOOST_TEST(loaded.addNewBlock(block));
+    db.write(block);
+    db.flush();
+    checkIndex(loaded, db);
+
+    // stale entries left behind by a rewritten chain are not trusted
+    const auto txid = loaded.at(1).transactions().at(0).id();
+    loaded.resize(1);
+    db.reset();
+    db.writeChain(loaded);
+    BOOST_TEST(db.findTransaction(txid).has_value());
+    BOOST_TEST(!ash::FindTransaction(loaded, db, txid).has_value());
+}
+
+BOOST_AUTO_TEST_CASE(TxIndexBatchTest)
+{
+    TempFolder folder;
+    auto chain = LoadBlockchain("blockchain4.json");
+    const auto initialSize = chain.size();
+
+    for (auto count = 0u; count < 300; count++)
+    {
+        auto block = CreateCoinbaseBlock(chain);
+        BOOST_REQUIRE(chain.addNewBlock(block));
+    }
+
+    // a write buffer this small makes LevelDB write tables while indexing
+    ash::db::TxIndexOptions options;
+    options.cacheSize = 64u * 1024u;
+    options.writeBufferSize = 64u * 1024u;
+
+    for (const auto bloomBits : { 0u, 10u })
+    {
+        options.bloomBits = bloomBits;
+        {
+            ash::Blockchain loaded;
+            ash::ChainDatabase db{ folder.path.string() };
+            db.setTxIndexOptions(options);
+            db.initialize(loaded, [&chain]() { return chain.at(0); });
+            BOOST_TEST(db.txIndexReady());
+
+            // the queued blocks are indexed as one group
+            for (auto idx = loaded.size(); idx < chain.size(); idx++)
+            {
+                db.write(chain.at(idx));
+            }
+
+            db.flush();
+            BOOST_TEST(db.txIndexReady());
+        }
+
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string() };
+        db.setTxIndexOptions(options);
+        db.initialize(loaded, nullptr);
+        BOOST_TEST(db.txIndexReady());
+        BOOST_TEST(loaded.size() == chain.size());
+
+        for (auto idx = initialSize; idx < chain.size(); idx++)
+        {
+            const auto& txid = chain.at(idx).transactions().at(0).id();
+            const auto txpt = db.findTransaction(txid);
+            BOOST_TEST((txpt == ash::TxPoint{ idx, 0 }));
+        }
+
+        BOOST_TEST(!db.findTransaction("notatransaction").has_value());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BlockIndexFileTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+    const auto indexfile = folder.path / "chain.ashidx";
+
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.writeChain(chain);
+
+        // each block can be read on its own
+        for (auto idx = 0u; idx < chain.size(); idx++)
+        {
+            const auto block = db.readBlock(idx);
+            BOOST_TEST(block.has_value());
+            BOOST_TEST(block->hash() == chain.at(idx).hash());
+            BOOST_TEST(db.hasBlock(idx, chain.at(idx).hash()));
+        }
+
+        BOOST_TEST(!db.readBlock(chain.size()).has_value());
+    }
+
+    const auto saved = ReadFile(indexfile);
+    BOOST_TEST(saved.substr(0, 8) == "ASHINDEX"sv);
+
+    // a damaged index is rebuilt when the chain is loaded
+    {
+        std::ofstream ofs(indexfile.string(), std::ios::binary | std::ios::trunc);
+        ofs << saved.substr(0, saved.size() - 3);
+    }
+
+    ash::Blockchain loaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(loaded, nullptr);
+    BOOST_TEST(ReadFile(indexfile) == saved);
+
+    // appended blocks are appended to the index
+    auto block = CreateCoinbaseBlock(loaded);
+    BOOST_TEST(loaded.addNewBlock(block));
+    db.write(block);
+    db.flush();
+
+    BOOST_TEST(ReadFile(indexfile).size() > saved.size());
+    BOOST_TEST(db.readBlock(chain.size())->hash() == block.hash());
+}
+
+BOOST_AUTO_TEST_CASE(SegmentedDatabaseTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_REQUIRE(chain.size() > 2);
+
+    // small enough that every block starts a new segment
+    constexpr auto maxFileSize = 64u;
+
+    {
+        ash::ChainDatabase db{ folder.path.string(), maxFileSize };
+        db.writeChain(chain);
+        BOOST_TEST(db.segmentCount() == chain.size());
+        BOOST_TEST(boost::filesystem::exists(folder.path / "chain.ashman"));
+        BOOST_TEST(boost::filesystem::exists(folder.path / "chain.00001.ashdb"));
+
+        for (auto idx = 0u; idx < chain.size(); idx++)
+        {
+            BOOST_TEST(db.readBlock(idx)->hash() == chain.at(idx).hash());
+        }
+    }
+
+    // the segments are found again through the manifest
+    {
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string(), maxFileSize };
+        db.initialize(loaded, nullptr);
+        BOOST_TEST(loaded.size() == chain.size());
+        BOOST_TEST(loaded.back().hash() == chain.back().hash());
+
+        // truncating removes the segments after the truncated one
+        db.truncateTo(1);
+        BOOST_TEST(db.segmentCount() == 2u);
+        BOOST_TEST(!boost::filesystem::exists(folder.path / "chain.00002.ashdb"));
+
+        db.write(chain.at(1));
+        db.flush();
+        BOOST_TEST(db.segmentCount() == 2u);
+        db.write(chain.at(2));
+        db.flush();
+        BOOST_TEST(db.segmentCount() == 3u);
+        BOOST_TEST(db.readBlock(2)->hash() == chain.at(2).hash());
+    }
+
+    // a replaced chain with fewer segments drops the extra ones
+    {
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string() };
+        db.initialize(loaded, nullptr);
+        BOOST_TEST(loaded.size() == 3u);
+
+        db.replaceChain(chain);
+        BOOST_TEST(db.segmentCount() == 1u);
+        BOOST_TEST(!boost::filesystem::exists(folder.path / "chain.00001.ashdb"));
+    }
+
+    ash::Blockchain reloaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(reloaded, nullptr);
+    BOOST_TEST(reloaded.size() == chain.size());
+}
+
+BOOST_AUTO_TEST_CASE(TruncateChainTest)
+{
+    TempFolder folder;
+    TempFolder headFolder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_REQUIRE(chain.size() > 2);
+
+    // a database that only has the first two blocks
+    {
+        ash::ChainDatabase db{ headFolder.path.string() };
+        db.write(chain.at(0));
+        db.write(chain.at(1));
+    }
+
+    ash::ChainDatabase db{ folder.path.string() };
+    db.writeChain(chain);
+    db.truncateTo(2);
+
+    BOOST_TEST(ReadFile(folder.path / "chain.ashdb") == ReadFile(headFolder.path / "chain.ashdb"));
+    BOOST_TEST(ReadFile(folder.path / "chain.ashidx") == ReadFile(headFolder.path / "chain.ashidx"));
+    BOOST_TEST(db.readBlock(1).has_value());
+    BOOST_TEST(!db.readBlock(2).has_value());
+
+    // truncating past the end changes nothing
+    db.truncateTo(chain.size());
+    BOOST_TEST(db.readBlock(1).has_value());
+
+    db.write(chain.at(2));
+    db.flush();
+    BOOST_TEST(db.readBlock(2)->hash() == chain.at(2).hash());
+}
+
+BOOST_AUTO_TEST_CASE(WriteBehindTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+
+    for (const auto syncMode : { ash::db::SyncMode::None, ash::db::SyncMode::Group, ash::db::SyncMode::Full })
+    {
+        ash::ChainDatabase db{ folder.path.string(), ash::DatabaseFileSizeDefault, syncMode };
+        db.reset();
+        for (const auto& block : chain)
+        {
+            db.write(block);
+        }
+
+        db.flush();
+        for (auto idx = 0u; idx < chain.size(); idx++)
+        {
+            BOOST_TEST(db.readBlock(idx)->hash() == chain.at(idx).hash());
+        }
+    }
+
+    // the queued blocks are appended before the database is closed
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.reset();
+        for (const auto& block : chain)
+        {
+            db.write(block);
+        }
+    }
+
+    ash::Blockchain loaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(loaded, nullptr);
+    BOOST_TEST(loaded.size() == chain.size());
+}
+
+BOOST_AUTO_TEST_CASE(WriteErrorTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+
+    // each block gets a segment of its own, and the segment of the
+    // third block cannot be replaced since a folder is in its place
+    ash::ChainDatabase db{ folder.path.string(), 1, ash::db::SyncMode::Full };
+    db.reset();
+    boost::filesystem::create_directories(folder.path / "chain.00002.ashdb" / "blocked");
+
+    db.write(chain.at(0));
+    db.write(chain.at(1));
+    BOOST_CHECK_THROW(db.write(chain.at(2)), std::exception);
+
+    // the failed block is not counted as written and the error sticks
+    BOOST_TEST(db.readBlock(1).has_value());
+    BOOST_TEST(!db.readBlock(2).has_value());
+    BOOST_CHECK_THROW(db.write(chain.at(3)), std::exception);
+    BOOST_CHECK_THROW(db.flush(), std::exception);
+
+    // rewriting the files clears it
+    boost::filesystem::remove_all(folder.path / "chain.00002.ashdb");
+    db.replaceChain(chain);
+    BOOST_CHECK_NO_THROW(db.flush());
+    BOOST_TEST(db.readBlock(3)->hash() == chain.at(3).hash());
+}
+
+BOOST_AUTO_TEST_CASE(WriteErrorReorgTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+
+    {
+        ash::ChainDatabase db{ folder.path.string(), 1, ash::db::SyncMode::Full };
+        db.reset();
+        boost::filesystem::create_directories(folder.path / "chain.00002.ashdb" / "blocked");
+
+        db.write(chain.at(0));
+        db.write(chain.at(1));
+        BOOST_CHECK_THROW(db.write(chain.at(2)), std::exception);
+        boost::filesystem::remove_all(folder.path / "chain.00002.ashdb");
+
+        // a reorg that keeps every appended block cannot clear the error,
+        // the blocks the failed group lost would be missing
+        db.truncateTo(2);
+        BOOST_CHECK_THROW(db.write(chain.at(2)), std::exception);
+
+        // one that rolls back an appended block cuts the failed group off
+        db.truncateTo(1);
+        BOOST_CHECK_NO_THROW(db.flush());
+        for (auto idx = 1u; idx < chain.size(); idx++)
+        {
+            db.write(chain.at(idx));
+        }
+
+        BOOST_CHECK_NO_THROW(db.flush());
+        for (auto idx = 0u; idx < chain.size(); idx++)
+        {
+            BOOST_TEST(db.readBlock(idx)->hash() == chain.at(idx).hash());
+        }
+    }
+
+    // the database loads back
+    ash::Blockchain loaded;
+    ash::ChainDatabase reopened{ folder.path.string(), 1 };
+    reopened.initialize(loaded, nullptr);
+    BOOST_TEST(loaded.size() == chain.size());
+    BOOST_TEST(loaded.isValidChain());
+}
+
+BOOST_AUTO_TEST_CASE(TornTailRecoveryTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+    const auto dbfile = folder.path / "chain.ashdb";
+    const auto indexfile = folder.path / "chain.ashidx";
+
+    // the block index is written after the records, so a crash leaves
+    // the index without the last record
+    std::string savedIndex;
+    {
+        auto head = chain;
+        head.resize(chain.size() - 1);
+
+        ash::ChainDatabase db{ folder.path.string() };
+        db.writeChain(head);
+        savedIndex = ReadFile(indexfile);
+
+        db.write(chain.back());
+        db.flush();
+    }
+
+    {
+        std::ofstream ofs(indexfile.string(), std::ios::binary | std::ios::trunc);
+        ofs << savedIndex;
+    }
+
+    // the last record is cut short like a write interrupted by a crash
+    const auto fullSize = boost::filesystem::file_size(dbfile);
+    boost::filesystem::resize_file(dbfile, fullSize - 10);
+
+    {
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string() };
+        db.initialize(loaded, nullptr);
+        BOOST_TEST(loaded.size() == chain.size() - 1);
+        BOOST_TEST(loaded.back().hash() == chain.at(chain.size() - 2).hash());
+
+        // the torn tail is gone so the missing block can be appended
+        db.write(chain.back());
+        db.flush();
+    }
+
+    BOOST_TEST(boost::filesystem::file_size(dbfile) == fullSize);
+
+    ash::Blockchain reloaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(reloaded, nullptr);
+    BOOST_TEST(reloaded.size() == chain.size());
+}
+
+BOOST_AUTO_TEST_CASE(CorruptRecordLengthTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+    const auto dbfile = folder.path / "chain.ashdb";
+
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.writeChain(chain);
+    }
+
+    // the length of the second record claims more than the file holds,
+    // which reads like a torn tail but the blocks after it are intact
+    auto raw = ReadFile(dbfile);
+    constexpr std::size_t headerSize = 8 + sizeof(std::uint32_t);
+
+    std::uint32_t firstLength = 0;
+    std::memcpy(&firstLength, raw.data() + headerSize, sizeof(firstLength));
+    const auto offset = headerSize + sizeof(std::uint32_t) + firstLength + sizeof(std::uint32_t);
+    BOOST_REQUIRE(offset < raw.size());
+
+    const std::uint32_t badLength = 0x7fffffff;
+    std::memcpy(raw.data() + offset, &badLength, sizeof(badLength));
+
+    {
+        std::ofstream ofs(dbfile.string(), std::ios::binary | std::ios::trunc);
+        ofs << raw;
+    }
+
+    // the segment is left alone for the corruption to be looked at
+    {
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string() };
+        BOOST_CHECK_THROW(db.initialize(loaded, nullptr), std::logic_error);
+    }
+
+    BOOST_TEST(boost::filesystem::file_size(dbfile) == raw.size());
+}
+
+BOOST_AUTO_TEST_CASE(InvalidChainLoadTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+    const auto dbfile = folder.path / "chain.ashdb";
+
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.writeChain(chain);
+    }
+
+    // change one character of a stored block hash
+    auto data = ReadFile(dbfile);
+    const auto& hash = chain.at(2).hash();
+    const auto pos = data.find(hash);
+    BOOST_REQUIRE(pos != std::string::npos);
+    data[pos] = (data[pos] == '0' ? '1' : '0');
+
+    {
+        std::ofstream ofs(dbfile.string(), std::ios::binary | std::ios::trunc);
+        ofs << data;
+    }
+
+    ash::Blockchain loaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    BOOST_CHECK_THROW(db.initialize(loaded, nullptr), std::logic_error);
+}
+
+BOOST_AUTO_TEST_CASE(HeadersOnlyChainTest)
+{
+    TempFolder folder;
+    const auto chain = LoadBlockchain("blockchain4.json");
+
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.writeChain(chain);
+    }
+
+    {
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string() };
+        loaded.setBlockReader(&db, 2);
+        db.initialize(loaded, nullptr);
+
+        BOOST_TEST(loaded.headersOnly());
+        BOOST_TEST(loaded.size() == chain.size());
+        BOOST_TEST(loaded.isValidChain());
+        BOOST_TEST((loaded.unspentTxOuts() == chain.unspentTxOuts()));
+        BOOST_TEST(loaded.cumDifficulty() == chain.cumDifficulty());
+
+        for (auto idx = 0u; idx < chain.size(); idx++)
+        {
+            BOOST_TEST(!loaded.at(idx).hasTransactions());
+            BOOST_TEST(loaded.at(idx).txDigest() == chain.at(idx).txDigest());
+
+            // the transactions are loaded from the database
+            const auto block = loaded.fullBlock(idx);
+            BOOST_TEST(block->hasTransactions());
+            BOOST_TEST(block->hash() == chain.at(idx).hash());
+            BOOST_TEST(block->transactions().size() == chain.at(idx).transactions().size());
+
+            nl::json expected = ash::GetBlockDetails(chain, idx);
+            nl::json actual = ash::GetBlockDetails(loaded, idx);
+            BOOST_TEST(expected.dump() == actual.dump());
+        }
+
+        nl::json expected = chain;
+        nl::json actual = loaded;
+        BOOST_TEST(expected.dump() == actual.dump());
+
+        // a new block keeps its transactions until it is in the database
+        auto block = CreateCoinbaseBlock(loaded);
+        BOOST_TEST(loaded.addNewBlock(block));
+        BOOST_TEST(loaded.back().hasTransactions());
+        db.write(block);
+
+        // rolling back loads the blocks that are removed
+        loaded.resize(2);
+        BOOST_TEST(loaded.size() == 2);
+        auto expectedChain = chain;
+        expectedChain.resize(2);
+        BOOST_TEST((loaded.unspentTxOuts() == expectedChain.unspentTxOuts()));
+
+        // the file is replaced while the chain still reads from it
+        db.replaceChain(loaded);
+        for (auto idx = 0u; idx < loaded.size(); idx++)
+        {
+            BOOST_TEST(loaded.fullBlock(idx)->hash() == chain.at(idx).hash());
+            BOOST_TEST(db.hasBlock(idx, chain.at(idx).hash()));
+        }
+
+        BOOST_TEST(!db.hasBlock(2, chain.at(2).hash()));
+    }
+
+    ash::Blockchain reloaded;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.initialize(reloaded, nullptr);
+    BOOST_TEST(reloaded.size() == 2);
+    BOOST_TEST(reloaded.isValidChain());
+    BOOST_TEST(reloaded.at(1).hasTransactions());
+}
+
+BOOST_AUTO_TEST_CASE(ChainStateSnapshotTest)
+{
+    TempFolder folder;
+    auto chain = LoadBlockchain("blockchain4.json");
+    BOOST_REQUIRE(chain.size() > 2);
+
+    const auto snapshotfile = folder.path / "chain.0000000004.ashsnap";
+    const auto checkState = 
+        [](const ash::Blockchain& actual, const ash::Blockchain& expected)
+        {
+            BOOST_TEST(actual.size() == expected.size());
+            BOOST_TEST((actual.unspentTxOuts() == expected.unspentTxOuts()));
+            BOOST_TEST(actual.cumDifficulty() == expected.cumDifficulty());
+            for (const auto& txout : expected.unspentTxOuts())
+            {
+                BOOST_TEST((actual.addressLedger(*txout.address) == expected.addressLedger(*txout.address)));
+            }
+        };
+
+    {
+        ash::ChainDatabase db{ folder.path.string() };
+        db.setSnapshotInterval(2);
+        db.writeChain(chain);
+        db.flush();
+        db.checkpoint(chain);
+    }
+
+    BOOST_TEST(boost::filesystem::exists(snapshotfile));
+
+    // the state is restored from the snapshot instead of being replayed
+    {
+        ash::Blockchain restored;
+        ash::ChainDatabase db{ folder.path.string() };
+        db.setSnapshotInterval(2);
+        db.initialize(restored, nullptr);
+        checkState(restored, chain);
+
+        // the TxOuts the blocks spent are restored so they can be rolled back
+        auto expected = chain;
+        expected.resize(2);
+        restored.resize(2);
+        checkState(restored, expected);
+
+        // the snapshot is of blocks that are no longer in the database
+        db.truncateTo(2);
+        BOOST_TEST(!boost::filesystem::exists(snapshotfile));
+
+        db.write(chain.at(2));
+        db.write(chain.at(3));
+        db.checkpoint(chain);
+        db.flush();
+        BOOST_TEST(boost::filesystem::exists(snapshotfile));
+    }
+
+    // a snapshot past the end of the chain is dropped and the state
+    // is replayed from the blocks, the last record is torn as if the
+    // database crashed before the block index was written
+    const auto dbfile = folder.path / "chain.ashdb";
+    boost::filesystem::resize_file(dbfile, boost::filesystem::file_size(dbfile) - 10);
+    boost::filesystem::remove(folder.path / "chain.ashidx");
+
+    ash::Blockchain replayed;
+    ash::ChainDatabase db{ folder.path.string() };
+    db.setSnapshotInterval(2);
+    db.initialize(replayed, nullptr);
+
+    auto expected = chain;
+    expected.resize(chain.size() - 1);
+    checkState(replayed, expected);
+    db.flush();
+    BOOST_TEST(!boost::filesystem::exists(snapshotfile));
+    BOOST_TEST(boost::filesystem::exists(folder.path / "chain.0000000003.ashsnap"));
+}
+
+BOOST_AUTO_TEST_CASE(PrunedDatabaseTest)
+{
+    TempFolder folder;
+    auto chain = LoadBlockchain("blockchain4.json");
+    const auto expected = chain;
+    BOOST_REQUIRE(chain.size() > 2);
+
+    // small enough that every block starts a new segment
+    constexpr auto maxFileSize = 64u;
+    const auto segmentfile = folder.path / "chain.00001.ashdb";
+
+    {
+        ash::ChainDatabase db{ folder.path.string(), maxFileSize };
+        db.setSnapshotInterval(2);
+        db.setPruneDepth(1);
+        db.writeChain(chain);
+        db.flush();
+
+        const auto fullSize = boost::filesystem::file_size(segmentfile);
+
+        // the snapshot is written and the segments pruned by the
+        // persistence thread
+        db.checkpoint(chain);
+        db.flush();
+
+        // the last segment is still appended to and keeps its block
+        BOOST_TEST(db.prunedHeight() == chain.size() - 1);
+        BOOST_TEST(boost::filesystem::file_size(segmentfile) < fullSize);
+        for (auto idx = 0u; idx < chain.size(); idx++)
+        {
+            const auto block = db.readBlock(idx);
+            BOOST_REQUIRE(block.has_value());
+            BOOST_TEST(block->hash() == chain.at(idx).hash());
+            BOOST_TEST(block->txDigest() == chain.at(idx).txDigest());
+            BOOST_TEST(block->hasTransactions() == (idx >= db.prunedHeight()));
+        }
+    }
+
+    // the pruned blocks are checked with their transaction digest and
+    // their state comes from the snapshot
+    {
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string(), maxFileSize };
+        db.setSnapshotInterval(2);
+        db.setPruneDepth(1);
+        db.initialize(loaded, nullptr);
+
+        BOOST_TEST(loaded.size() == chain.size());
+        BOOST_TEST(db.prunedHeight() == chain.size() - 1);
+        BOOST_TEST(loaded.isValidChain());
+        BOOST_TEST((loaded.unspentTxOuts() == expected.unspentTxOuts()));
+        BOOST_TEST(loaded.cumDifficulty() == expected.cumDifficulty());
+
+        // a chain without a block reader hands out its pruned blocks as
+        // they are instead of trying to load their transactions
+        BOOST_TEST(!loaded.headersOnly());
+        BOOST_TEST(!loaded.fullBlock(0)->hasTransactions());
+        BOOST_TEST(loaded.fullBlock(0)->hash() == chain.at(0).hash());
+
+        nl::json block = ash::GetBlockDetails(loaded, 0);
+        BOOST_TEST(block["transactions"].empty());
+
+        // every encoding of a pruned block marks it, and it still
+        // hashes to its hash once decoded
+        BOOST_TEST(block["pruned"].get<bool>());
+        const auto decoded = nl::json(*loaded.fullBlock(1)).get<ash::Block>();
+        BOOST_TEST(!decoded.hasTransactions());
+        BOOST_TEST(ash::CalculateBlockHash(decoded) == chain.at(1).hash());
+        BOOST_TEST(!nl::json(loaded.back()).contains("pruned"));
+
+        // rolling back past the only snapshot writes one of the rolled
+        // back chain before the snapshot is removed
+        BOOST_CHECK_THROW(db.truncateTo(chain.size() - 1), std::logic_error);
+        loaded.resize(chain.size() - 1);
+        db.truncateTo(loaded);
+        BOOST_TEST(boost::filesystem::exists(folder.path / "chain.0000000003.ashsnap"));
+        BOOST_TEST(!boost::filesystem::exists(folder.path / "chain.0000000004.ashsnap"));
+    }
+
+    {
+        ash::Blockchain loaded;
+        ash::ChainDatabase db{ folder.path.string(), maxFileSize };
+        db.setSnapshotInterval(2);
+        db.initialize(loaded, nullptr);
+
+        auto rolledBack = expected;
+        rolledBack.resize(chain.size() - 1);
+        BOOST_TEST(loaded.size() == rolledBack.size());
+        BOOST_TEST((loaded.unspentTxOuts() == rolledBack.unspentTxOuts()));
+    }
+
+    // without a snapshot the pruned blocks cannot be replayed
+    for (const auto& entry : boost::filesystem::directory_iterator{ folder.path })
+    {
+        if (entry.path().extension() == ".ashsnap")
+        {
+            boost::filesystem::remove(entry.path());
+        }
+    }
+
+    ash::Blockchain loaded;
+    ash::ChainDatabase db{ folder.path.string(), maxFileSize };
+    BOOST_CHECK_THROW(db.initialize(loaded, nullptr), std::logic_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END() // database